@@ -2,6 +2,7 @@
 #include "../includes/object.h"
 #include "../includes/memory.h"
 #include "../includes/vm.h"
+#include "../includes/gcollect.h"
 #include <stdio.h>
 #include <string.h>
 
@@ -29,7 +30,7 @@ static ObjUpvalue* unplugUpvalues(VM* vm, Value* slot) {
     return first;
 }
 
-bool create(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+static bool create(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     if (argCount < 1) {
         msapi_runtimeError(vm, "Insufficient number of arguments, expected 1, got 0");
         return false;
@@ -54,7 +55,7 @@ bool create(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     return true;
 }
 
-bool resume(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+static bool resume(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     if (argCount < 1) {
         msapi_runtimeError(vm, "Insufficient argument count, expected 1 got 0");
         return false;
@@ -152,8 +153,8 @@ bool resume(VM* vm, Obj* self, int argCount, bool shouldReturn) {
         }
 
         /* Do the cleanup of the old state */
-        reallocate(vm, coro->frames, sizeof(CallFrame) * coro->frameCount, 0);
-        reallocate(vm, coro->stack, sizeof(Value) * coro->stackSize, 0);
+        reallocateCategory(vm, MEMORY_COROUTINES, coro->frames, sizeof(CallFrame) * coro->frameCount, 0);
+        reallocateCategory(vm, MEMORY_COROUTINES, coro->stack, sizeof(Value) * coro->stackSize, 0);
         coro->stack = NULL;
         coro->upvalues = NULL;
         coro->frames = NULL;
@@ -171,7 +172,7 @@ bool resume(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     return true;
 }
 
-bool yield(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+static bool yield(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     /* Yields the last coroutine call */
     CallFrame* lastCoroutine = NULL;
     int saveCount = 0;
@@ -197,6 +198,13 @@ bool yield(VM* vm, Obj* self, int argCount, bool shouldReturn) {
         msapi_runtimeError(vm, "Not in a coroutine");
         return false;
     }
+
+    /* The frames being saved can't reach below a native that called back into 
+     * the script, since that native is still running on the C stack */
+    if (vm->frameCount - saveCount <= vm->callBoundary) {
+        msapi_runtimeError(vm, "Attempt to yield across a native call boundary");
+        return false;
+    }
     
     ObjCoroutine* coroutine = AS_COROUTINE(lastCoroutine->slotPtr[0]);
     int stackSize = (int)(vm->stackTop - lastCoroutine->slotPtr);
@@ -205,8 +213,8 @@ bool yield(VM* vm, Obj* self, int argCount, bool shouldReturn) {
      * our return value which has already been popped from the stack */
 
     msapi_push(vm, returnValue);   
-    CallFrame* frameStorage = reallocate(vm, NULL, 0, sizeof(CallFrame) * saveCount);
-    Value* stack = reallocate(vm, NULL, 0, sizeof(Value) * stackSize);
+    CallFrame* frameStorage = reallocateCategory(vm, MEMORY_COROUTINES, NULL, 0, sizeof(CallFrame) * saveCount);
+    Value* stack = reallocateCategory(vm, MEMORY_COROUTINES, NULL, 0, sizeof(Value) * stackSize);
     msapi_pop(vm);
     
     /* Copy the callframes and the stack */    
@@ -240,6 +248,8 @@ bool yield(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     coroutine->stackSize = stackSize;
     coroutine->stack = stack;
     coroutine->state = CORO_YIELDING;
+    /* The saved stack holds references the coroutine didn't have before */
+    gcWriteBarrierAll(vm, &coroutine->obj);
     
     vm->frameCount -= saveCount;
     vm->stackTop = lastCoroutine->slotPtr;
@@ -253,7 +263,7 @@ bool yield(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     return true;
 }
 
-bool state(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+static bool state(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     if (argCount < 1) {
         msapi_runtimeError(vm, "Expected 1 argument, got 0");
         return false;
@@ -283,3 +293,13 @@ bool state(VM* vm, Obj* self, int argCount, bool shouldReturn) {
 
     return true;
 }
+
+const NativeModuleFunction coroutineModule[] = {
+    {"create", &create, 1},
+    {"resume", &resume, 1},
+    {"yield", &yield, 0},
+    {"state", &state, 1},
+    {NULL, NULL, 0}
+};
+
+MS_REGISTER_MODULE(coroutineModule)
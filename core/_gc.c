@@ -0,0 +1,309 @@
+#include "../includes/msapi.h"
+#include "../includes/object.h"
+#include "../includes/memory.h"
+#include "../includes/vm.h"
+#include "../includes/gcollect.h"
+#include "../includes/heapprof.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool collect(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+    msapi_popn(vm, argCount + 1);
+    gcCollect(vm);
+
+    if (shouldReturn) {
+        msapi_push(vm, NATIVE_TO_NUMBER((double)vm->bytesAllocated));
+    }
+
+    return true;
+}
+
+static bool step(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+    int units = vm->gcStepUnits;
+
+    if (argCount > 0) {
+        Value unitsVal = msapi_getArg(vm, 1, argCount);
+
+        if (!CHECK_NUMBER(unitsVal) || AS_NUMBER(unitsVal) < 1) {
+            msapi_runtimeError(vm, "Expected a positive number of work units");
+            return false;
+        }
+
+        units = (int)AS_NUMBER(unitsVal);
+    }
+
+    msapi_popn(vm, argCount + 1);
+    bool finished = gcStep(vm, units);
+
+    if (shouldReturn) {
+        msapi_push(vm, NATIVE_TO_BOOLEAN(finished));
+    }
+
+    return true;
+}
+
+static bool stop(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+    msapi_popn(vm, argCount + 1);
+    vm->gcEnabled = false;
+
+    if (shouldReturn) {
+        msapi_push(vm, NIL());
+    }
+
+    return true;
+}
+
+static bool start(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+    msapi_popn(vm, argCount + 1);
+    vm->gcEnabled = true;
+
+    if (shouldReturn) {
+        msapi_push(vm, NIL());
+    }
+
+    return true;
+}
+
+static bool set(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+    if (argCount < 2) {
+        msapi_runtimeError(vm, "Expected 2 arguments, got %d", argCount);
+        return false;
+    }
+
+    Value name = msapi_getArg(vm, 1, argCount);
+    Value value = msapi_getArg(vm, 2, argCount);
+    char buffer[64];
+
+    if (!CHECK_STRING(name)) {
+        msapi_runtimeError(vm, "Expected the name of the option as a string");
+        return false;
+    }
+
+    /* Options are parsed from strings, numbers are formatted the same way */
+    if (CHECK_NUMBER(value)) {
+        snprintf(buffer, sizeof(buffer), "%.17g", AS_NUMBER(value));
+    } else if (CHECK_STRING(value)) {
+        snprintf(buffer, sizeof(buffer), "%s", AS_NATIVE_STRING(value));
+    } else {
+        msapi_runtimeError(vm, "Expected a number or a string as the value of the option");
+        return false;
+    }
+
+    if (!gcSetOption(vm, AS_NATIVE_STRING(name), buffer)) {
+        msapi_runtimeError(vm, "Invalid value '%s' for option '%s'", buffer, AS_NATIVE_STRING(name));
+        return false;
+    }
+
+    msapi_popn(vm, argCount + 1);
+
+    if (shouldReturn) {
+        msapi_push(vm, NIL());
+    }
+
+    return true;
+}
+
+static void setField(VM* vm, ObjTable* table, const char* name, Value value) {
+    /* The table is on the stack, and the value is stored before anything
+     * else is allocated */
+    msapi_push(vm, value);
+    msapi_push(vm, OBJ(allocateString(vm, name, strlen(name))));
+    insertTable(&table->table, AS_STRING(msapi_peek(vm, 0)), msapi_peek(vm, 1));
+    gcWriteBarrierEntry(vm, &table->obj, msapi_peek(vm, 0), msapi_peek(vm, 1));
+    msapi_popn(vm, 2);
+}
+
+static void setStringField(VM* vm, ObjTable* table, const char* name, const char* value) {
+    msapi_push(vm, OBJ(allocateString(vm, value, strlen(value))));
+    setField(vm, table, name, msapi_peek(vm, 0));
+    msapi_pop(vm);
+}
+
+static bool stats(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+    msapi_popn(vm, argCount + 1);
+    if (!shouldReturn) return true;
+
+    static const char* phases[] = { "pause", "mark", "sweep" };
+
+    /* Filling the tables allocates, so the numbers are taken first */
+    size_t bytes = vm->bytesAllocated;
+    size_t memory[MEMORY_CATEGORIES];
+    memcpy(memory, vm->memory, sizeof(memory));
+
+    ObjTable* table = allocateTable(vm);
+    msapi_push(vm, OBJ(table));
+
+    setField(vm, table, "bytes", NATIVE_TO_NUMBER((double)bytes));
+    setField(vm, table, "threshold", NATIVE_TO_NUMBER((double)vm->nextGC));
+    setField(vm, table, "collections", NATIVE_TO_NUMBER((double)vm->gcCollections));
+    setField(vm, table, "fullCollections", NATIVE_TO_NUMBER((double)vm->gcFullCollections));
+    setField(vm, table, "finalized", NATIVE_TO_NUMBER((double)vm->gcFinalized));
+    #ifdef MS_BUILTIN_MODULES
+    setField(vm, table, "builtinModules", NATIVE_TO_BOOLEAN(true));     /* Their containers hold no handle */
+    #else
+    setField(vm, table, "builtinModules", NATIVE_TO_BOOLEAN(false));
+    #endif
+    setField(vm, table, "pages", NATIVE_TO_NUMBER((double)(vm->objects.pageCount + vm->blocks.pageCount)));
+    setField(vm, table, "running", NATIVE_TO_BOOLEAN(vm->gcEnabled));
+    setField(vm, table, "growth", NATIVE_TO_NUMBER(vm->gcGrowFactor));
+    setField(vm, table, "minHeap", NATIVE_TO_NUMBER((double)vm->gcMinHeap));
+    setField(vm, table, "maxHeap", NATIVE_TO_NUMBER((double)vm->gcMaxHeap));
+    setField(vm, table, "threads", NATIVE_TO_NUMBER(vm->gcMarkThreads));
+    setStringField(vm, table, "mode", vm->gcMode == GC_MODE_INCREMENTAL ? "incremental" : "generational");
+    setStringField(vm, table, "phase", phases[vm->gcPhase]);
+
+    /* Bytes held per kind of allocation, these add up to bytes */
+    static const char* categories[] = {
+        "objects", "strings", "arrays", "tables", "bytecode", "coroutines", "collector", "other"
+    };
+
+    ObjTable* breakdown = allocateTable(vm);
+    msapi_push(vm, OBJ(breakdown));
+
+    for (int i = 0; i < MEMORY_CATEGORIES; i++) {
+        setField(vm, breakdown, categories[i], NATIVE_TO_NUMBER((double)memory[i]));
+    }
+
+    setField(vm, table, "memory", msapi_peek(vm, 0));
+    msapi_pop(vm);
+
+    /* The table is left on the stack as the return value */
+    return true;
+}
+
+static bool snapshot(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+    if (argCount < 1) {
+        msapi_runtimeError(vm, "Expected the path of the snapshot file");
+        return false;
+    }
+
+    Value path = msapi_getArg(vm, 1, argCount);
+
+    if (!CHECK_STRING(path)) {
+        msapi_runtimeError(vm, "Expected the path to be a string");
+        return false;
+    }
+
+    long count = writeHeapSnapshot(vm, AS_NATIVE_STRING(path));
+
+    if (count < 0) {
+        msapi_runtimeError(vm, "Could not write the heap snapshot to '%s'", AS_NATIVE_STRING(path));
+        return false;
+    }
+
+    msapi_popn(vm, argCount + 1);
+
+    if (shouldReturn) {
+        msapi_push(vm, NATIVE_TO_NUMBER((double)count));
+    }
+
+    return true;
+}
+
+static bool profile(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+    bool enable = true;
+
+    if (argCount > 0) {
+        Value value = msapi_getArg(vm, 1, argCount);
+
+        if (!CHECK_BOOLEAN(value)) {
+            msapi_runtimeError(vm, "Expected a boolean");
+            return false;
+        }
+
+        enable = AS_BOOL(value);
+    }
+
+    msapi_popn(vm, argCount + 1);
+
+    if (enable) {
+        startProfiler(vm);
+    } else {
+        stopProfiler(vm);
+    }
+
+    if (shouldReturn) {
+        msapi_push(vm, NIL());
+    }
+
+    return true;
+}
+
+static bool report(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+    int top = 20;
+
+    if (argCount > 0) {
+        Value topVal = msapi_getArg(vm, 1, argCount);
+
+        if (!CHECK_NUMBER(topVal) || AS_NUMBER(topVal) < 1) {
+            msapi_runtimeError(vm, "Expected a positive number of sites");
+            return false;
+        }
+
+        top = (int)AS_NUMBER(topVal);
+    }
+
+    msapi_popn(vm, argCount + 1);
+    writeProfileReport(vm, stdout, top);
+
+    if (shouldReturn) {
+        msapi_push(vm, NIL());
+    }
+
+    return true;
+}
+
+static bool sites(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+    if (vm->profiler == NULL) {
+        msapi_runtimeError(vm, "The allocation profiler isn't running");
+        return false;
+    }
+
+    msapi_popn(vm, argCount + 1);
+    if (!shouldReturn) return true;
+
+    /* Measured before anything is allocated, sites with live objects only */
+    int count;
+    SiteUsage* usage = measureSites(vm, &count);
+    ObjArray* array = allocateArray(vm);
+    msapi_push(vm, OBJ(array));
+
+    for (int i = 0; i < count && usage[i].liveCount > 0; i++) {
+        AllocSite* site = &vm->profiler->sites[usage[i].site];
+        ObjTable* table = allocateTable(vm);
+        msapi_push(vm, OBJ(table));
+
+        setStringField(vm, table, "function", site->function);
+        setField(vm, table, "line", NATIVE_TO_NUMBER(site->line));
+        setField(vm, table, "live", NATIVE_TO_NUMBER((double)usage[i].liveCount));
+        setField(vm, table, "liveBytes", NATIVE_TO_NUMBER((double)usage[i].liveBytes));
+        setField(vm, table, "allocations", NATIVE_TO_NUMBER((double)site->count));
+        setField(vm, table, "bytes", NATIVE_TO_NUMBER((double)site->bytes));
+
+        writeValueArray(&array->array, msapi_peek(vm, 0));
+        gcWriteBarrier(vm, &array->obj, msapi_peek(vm, 0));
+        msapi_pop(vm);
+    }
+
+    free(usage);
+
+    /* The array is left on the stack as the return value */
+    return true;
+}
+
+const NativeModuleFunction gcModule[] = {
+    {"collect", &collect, 0},
+    {"step", &step, 0},
+    {"stop", &stop, 0},
+    {"start", &start, 0},
+    {"set", &set, 2},
+    {"stats", &stats, 0},
+    {"snapshot", &snapshot, 1},
+    {"profile", &profile, 0},
+    {"report", &report, 0},
+    {"sites", &sites, 0},
+    {NULL, NULL, 0}
+};
+
+MS_REGISTER_MODULE(gcModule)
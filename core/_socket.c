@@ -19,7 +19,7 @@
 
 typedef int SOCKET;
 
-SOCKET _newSocket(VM* vm, const char* host, int port) {
+static SOCKET _newSocket(VM* vm, const char* host, int port) {
     struct hostent* server;                 /* Server Struct */ 
     struct sockaddr_in server_addr;         /* Details about the server & connection */ 
     
@@ -31,6 +31,7 @@ SOCKET _newSocket(VM* vm, const char* host, int port) {
 
     server = gethostbyname(host);
     if (server == NULL) {
+        close(sockfd);
         msapi_runtimeError(vm, "Unknown Host : '%s'", host);
         return -2;
     }
@@ -43,13 +44,14 @@ SOCKET _newSocket(VM* vm, const char* host, int port) {
     
     int result = connect(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr));
     if (result < 0) {
+        close(sockfd);
         msapi_runtimeError(vm, "Could not connect to host : '%s'", host);
         return -3;
     }
     return sockfd;
 } 
 
-int _readSocket(VM* vm, SOCKET sockfd, char** string) {
+static int _readSocket(VM* vm, SOCKET sockfd, char** string) {
     int max = 1300;
     char response[max + 1];
     int currentRead = 0;
@@ -75,7 +77,7 @@ int _readSocket(VM* vm, SOCKET sockfd, char** string) {
     return currentRead;
 }
 
-bool _writeSocket(SOCKET sockfd, char* chars, int length) {
+static bool _writeSocket(SOCKET sockfd, char* chars, int length) {
     int bytesWritten = 0;
     int currentWritten = 0;
 
@@ -95,7 +97,7 @@ bool _writeSocket(SOCKET sockfd, char* chars, int length) {
     return true;
 }
 
-bool newSocket(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+static bool newSocket(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     if (argCount < 2) {
         msapi_runtimeError(vm, "Too less arguments, expected 2, got %d", argCount);
         return false;
@@ -125,13 +127,15 @@ bool newSocket(VM* vm, Obj* self, int argCount, bool shouldReturn) {
         msapi_popn(vm, argCount + 1);
         msapi_push(vm, OBJ(socket));
     } else {
+        /* Nobody could ever close it */ 
+        close(sockfd);
         msapi_popn(vm, argCount + 1);
     }
 
     return true; 
 }
 
-bool closeSocket(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+static bool closeSocket(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     if (argCount < 1) {
         msapi_runtimeError(vm, "Too less arguments, expected 1, got 0");
         return false;
@@ -159,7 +163,7 @@ bool closeSocket(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     return true;
 }
 
-bool readSocket(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+static bool readSocket(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     if (argCount < 1) {
         msapi_runtimeError(vm, "Too less arguments, expected 1, got 0");
         return false;
@@ -205,7 +209,7 @@ bool readSocket(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     return true;
 }
 
-bool writeSocket(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+static bool writeSocket(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     if (argCount < 2) {
         msapi_runtimeError(vm, "Too less arguments, expected 2, got %d", argCount);
         return false;
@@ -244,3 +248,13 @@ bool writeSocket(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     
     return true;
 }
+
+const NativeModuleFunction socketModule[] = {
+    {"newSocket", &newSocket, 2},
+    {"closeSocket", &closeSocket, 1},
+    {"readSocket", &readSocket, 1},
+    {"writeSocket", &writeSocket, 2},
+    {NULL, NULL, 0}
+};
+
+MS_REGISTER_MODULE(socketModule)
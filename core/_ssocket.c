@@ -14,7 +14,7 @@
 
 /* Read Socket might need to be called in a loop to get the full response */
 
-int _readSocket(VM* vm, SSOCKET* ssocket, char** bufferPtr) {
+static int _readSocket(VM* vm, SSOCKET* ssocket, char** bufferPtr) {
     int max = 1300;
     char response[max + 1];
     int result = 0;
@@ -32,7 +32,7 @@ int _readSocket(VM* vm, SSOCKET* ssocket, char** bufferPtr) {
     return result; 
 }
 
-int _writeSocket(SSOCKET* ssocket, char* chars, int length) {
+static int _writeSocket(SSOCKET* ssocket, char* chars, int length) {
     int result = 0, totalWrite = 0;
 
     for (;;) {
@@ -47,7 +47,7 @@ int _writeSocket(SSOCKET* ssocket, char* chars, int length) {
     }
 }
 
-SSOCKET* _newSocket(VM* vm, char* host, int port) {
+static SSOCKET* _newSocket(VM* vm, char* host, int port) {
     /* Basic initalization for openssl */ 
     SSL_load_error_strings();
     ERR_load_BIO_strings();
@@ -94,7 +94,7 @@ SSOCKET* _newSocket(VM* vm, char* host, int port) {
         msapi_runtimeError(vm, "An Error Occured While Loading Certificates");
         return NULL;
     }
-    reallocateArray(name, sizeof(*name), 0);
+    reallocate(vm, name, strlen(name) + 1, 0);
    
     /* We attempt to connect to the server */ 
 
@@ -109,25 +109,25 @@ SSOCKET* _newSocket(VM* vm, char* host, int port) {
      * we also need to free the context later on, so we wrap it in our 
      * own struct and return it */ 
 
-    SSOCKET* ssocket = (SSOCKET*)reallocateArray(NULL, 0, sizeof(SSOCKET));
+    SSOCKET* ssocket = (SSOCKET*)reallocateArray(MEMORY_OTHER, NULL, 0, sizeof(SSOCKET));
     ssocket->ssl_bio = bio; 
     ssocket->ssl_ctx = ctx;
     
     return ssocket;
 }
 
-void _closeSocket(SSOCKET* ssocket) {
+static void _closeSocket(SSOCKET* ssocket) {
     /* Close and free the sockets */ 
 
     BIO_free_all(ssocket->ssl_bio);
     SSL_CTX_free(ssocket->ssl_ctx);
 
     /* Free our struct */ 
-    reallocateArray(ssocket, sizeof(SSOCKET), 0);
+    reallocateArray(MEMORY_OTHER, ssocket, sizeof(SSOCKET), 0);
 }
 
 
-bool newSocket(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+static bool newSocket(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     if (argCount < 2) {
         msapi_runtimeError(vm, "Too less arguments, expected 2, got %d", argCount);
         return false;
@@ -163,7 +163,7 @@ bool newSocket(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     return true;
 }
 
-bool closeSocket(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+static bool closeSocket(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     if (argCount < 1) {
         msapi_runtimeError(vm, "Too less arguments, expected 1, got 0");
         return false;
@@ -196,7 +196,7 @@ bool closeSocket(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     return true;
 }
 
-bool readSocket(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+static bool readSocket(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     if (argCount < 1) {
         msapi_runtimeError(vm, "Too less arguments, expected 1, got 0");
         return false;
@@ -236,7 +236,7 @@ bool readSocket(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     return true;
 }
 
-bool writeSocket(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+static bool writeSocket(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     if (argCount < 2) {
         msapi_runtimeError(vm, "Too less arguments, expected 2, got %d", argCount);
         return false;
@@ -274,3 +274,13 @@ bool writeSocket(VM* vm, Obj* self, int argCount, bool shouldReturn) {
 
     return true;
 }
+
+const NativeModuleFunction ssocketModule[] = {
+    {"newSocket", &newSocket, 2},
+    {"closeSocket", &closeSocket, 1},
+    {"readSocket", &readSocket, 1},
+    {"writeSocket", &writeSocket, 2},
+    {NULL, NULL, 0}
+};
+
+MS_REGISTER_MODULE(ssocketModule)
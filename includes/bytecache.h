@@ -0,0 +1,60 @@
+#ifndef ms_bytecache_h
+#define ms_bytecache_h
+#include "../includes/vm.h"
+#include "../includes/object.h"
+
+/* Precompiled bytecode cache
+ *
+ * Compiling a script to bytecode is redone on every run and for every import,
+ * so the compiled function tree is kept in a .megc file next to the source
+ * ("json.meg" is cached in "json.megc"), or in the directory named by the
+ * MEGA_CACHE_DIR environment variable. MEGA_CACHE=0 turns the cache off.
+ *
+ * A cache file starts with a header recording the format version, the number
+ * of opcodes, whether it was compiled as the main script, and the size,
+ * modification time and hash of the source it was compiled from. It is only
+ * used when all of them match the source being loaded, and when the hash of
+ * the rest of the file is still right, otherwise the source is compiled as
+ * usual and the cache file is written again. The rest of the file holds the
+ * functions, each one with its name, arity, upvalue count, bytecode, line
+ * table (as runs of equal lines) and constants, nested functions are written
+ * in place of the constant which refers to them.
+ *
+ * BYTECODE_VERSION has to be bumped whenever the compiler emits different
+ * bytecode for the same source */
+
+#define BYTECODE_CACHE                  /* Comment this to always compile from source */
+#define BYTECODE_VERSION 2
+#define BYTECODE_EXTENSION "megc"
+
+/* Modules compiled into the executable at build time, 'mega --embed=<file.c>
+ * <files...>' writes them as a C file, the Makefile links in the scripts of lib. An
+ * import checks them before the file system, by the path it would have opened
+ * ("lib/json.meg") */
+typedef struct {
+    const char* path;
+    const uint8_t* bytecode;                    /* Function tree, as in the body of a cache file */
+    size_t length;
+} EmbeddedModule;
+
+extern const EmbeddedModule embeddedModules[];
+extern const int embeddedModuleCount;
+
+const EmbeddedModule* findEmbeddedModule(const char* path);
+bool loadEmbeddedModule(VM* vm, const EmbeddedModule* module, ObjFunction* function);
+bool embedModules(VM* vm, const char* outPath, char** paths, int count);
+
+/* Same as compile(), but loads the function from the cache file of 'path'
+ * when it is up to date, and writes one after compiling otherwise. 'source'
+ * has to be the contents of the file at 'path' */
+InterpretResult compileCached(VM* vm, const char* path, const char* source, size_t length,
+                              ObjFunction* function, bool isMain);
+
+/* Compiles a script which is going to be imported on a thread of the parallel 
+ * compiler (see precompile.h), in the vm of the thread. Returns its function tree 
+ * as in the body of a cache file, allocated with malloc, or NULL if it didn't 
+ * compile or its cache file is up to date already. Writes the cache file */ 
+uint8_t* precompileModule(VM* vm, const char* path, const char* source, size_t length, size_t* bytecodeLength);
+bool loadBytecode(VM* vm, const uint8_t* bytecode, size_t length, ObjFunction* function);
+
+#endif
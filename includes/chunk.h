@@ -115,13 +115,20 @@ typedef enum {
     OP_RETEOF                                   /* Return from main function + EOF */ 
 } OPCODE;                                       /* Enum which defines opcodes */
 
+typedef struct {
+    int offset;                                 /* First byte of a run of bytes on the same line */
+    int line;
+} LineStart;
+
 typedef struct {
     int capacity;                               /* The capacity of the dynamic array */
     int elem_count;                             /* Number of elements in the dynamic array */
     int ins_count;                              /* Number of instructions */
     uint8_t* code;                              /* 8-bit unsigned int dynamic array for storing opcodes */
     ValueArray constants;                       /* Constant pool */
-    int* lines;                                 /* Stores lines for debugging */
+    LineStart* lines;                           /* Stores lines for debugging, one entry per line change */
+    int lineCount;
+    int lineCapacity;
 } Chunk;
 
 #define CONSTANT_MAX 65535
@@ -129,7 +136,8 @@ typedef struct {
 void initChunk(Chunk* chunk);                   /* FUnction to initialize an empty chunk */
 void writeChunk(Chunk* chunk, uint8_t byte, int line);     /* Function to write 1 opcode to a chunk */
 void writeLongByte(Chunk* chunk, uint16_t byte, int line);
-void writeLongByteAt(Chunk* chunk, uint16_t byte, unsigned int index, int line);
+void writeLongByteAt(Chunk* chunk, uint16_t byte, unsigned int index);
+int getLine(Chunk* chunk, int offset);          /* Line of the byte at the offset */
 void freeChunk(Chunk* chunk);                   /* Function to free the chunk and all its contents */
 int writeConstant(Chunk* chunk, Value value, int line);  /* Add a new constant to the constant pool of this chunk */
 int makeConstant(Chunk* chunk, Value value);
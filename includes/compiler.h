@@ -61,12 +61,18 @@ typedef enum {
 
 typedef enum {
     FLAG_DISSEMBLY,
+    FLAG_ALLOC_PROFILE, // --alloc-profile, report allocation sites at exit
     FLAG_COUNT          // number of flags
 } FlagType;
 
+#define GC_OPTION_MAX 16
+
 typedef struct {
     int numFlags;
     bool flags[FLAG_COUNT];
+    char* gcOptions[GC_OPTION_MAX];     /* "<option>=<value>" of the --gc- flags */
+    int gcOptionCount;
+    char* heapSnapshot;                 /* File written by --heap-snapshot at exit, or NULL */
 } FlagContainer;
 
 void initUintArray(UintArray* array);
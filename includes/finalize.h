@@ -0,0 +1,39 @@
+#ifndef ms_finalize_h
+#define ms_finalize_h
+#include "../includes/vm.h"
+#include "../includes/object.h"
+
+/* Finalization of native resources
+ *
+ * Sockets, secure sockets and DLL containers hold a file descriptor, TLS state 
+ * or a dlopen handle. When one of them is collected without being closed, the 
+ * sweeper only moves the resource onto the finalizer queue of the vm, closing 
+ * it can block and it would hold up the sweep (or an allocation which triggered 
+ * the sweep of a page). The queue is run once the collector step which filled 
+ * it has finished, and by freeVM. DLL handles are closed after everything else
+ * in the queue, as the other resources may need code the libraries loaded */ 
+
+typedef enum {
+    FINALIZE_SOCKET,
+    FINALIZE_SSOCKET,
+    FINALIZE_DLL
+} FinalizerType;
+
+struct Finalizer {
+    FinalizerType type;
+    union {
+        int sockfd;
+        SSOCKET* ssocket;
+        void* handle;
+    } as;
+};
+
+void queueFinalizer(VM* vm, Obj* obj);
+void runFinalizers(VM* vm);
+
+/* Cheap enough to call after every collector step */ 
+static inline void gcFinalize(VM* vm) {
+    if (vm->finalizerCount > 0) runFinalizers(vm);
+}
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef ms_gcmark_h
+#define ms_gcmark_h
+#include "../includes/vm.h"
+#include "../includes/object.h"
+
+/* Parallel marking
+ *
+ * With vm->gcMarkThreads above 1, the tracing of a collection is shared by that
+ * many threads (the interpreter's own thread included). Every thread drains its
+ * own grey stack and steals half of another thread's stack once it runs dry,
+ * mark bits are claimed with an atomic or on the page bitmap so an object is
+ * only ever blackened once. The helper threads are started by the first parallel
+ * trace and wait for the next one in between.
+ *
+ * The thread count comes from the MEGA_GC_THREADS environment variable,
+ * 0 starts one thread per core. Parallel marking needs pthreads and the
+ * GCC atomic builtins, elsewhere marking always runs on a single thread */
+
+#if !defined(_WIN32) && (defined(__GNUC__) || defined(__clang__))
+#define GC_PARALLEL_MARK
+#endif
+
+#define GC_MAX_MARK_THREADS 64
+#define GC_MARK_BATCH 64                    /* Grey objects a thread keeps out of reach of thieves */
+
+typedef struct GCWorker GCWorker;
+
+#ifdef GC_PARALLEL_MARK
+extern __thread GCWorker* gcCurrentWorker;  /* Set while the thread takes part in a parallel trace */
+void gcWorkerPush(GCWorker* worker, Obj* obj);
+#endif
+
+void gcSetMarkThreads(VM* vm, int threads);
+bool gcParallelTrace(VM* vm);               /* Returns false if the trace has to run serially */
+void freeMarker(VM* vm);
+
+#endif
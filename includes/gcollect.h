@@ -3,17 +3,115 @@
 #include "../includes/vm.h"
 #include "../includes/value.h"
 #include "../includes/object.h"
+#include "../includes/pool.h"
+
+/* The collector is generational, new objects are allocated young and 
+ * every object which survives a collection is promoted to the old generation. 
+ * Minor collections only trace and sweep the young generation, a full 
+ * collection runs once the old generation has grown by GC_HEAP_GROW_FACTOR 
+ * since the last full one. 
+ *
+ * Only marking stops the world, the garbage is swept lazily afterwards: 
+ * every object allocation sweeps one page, and a page which is about to 
+ * be allocated from is swept first. The sweep is completed before 
+ * the next collection starts */ 
+
+#define GC_NURSERY_SIZE (1024 * 1024)       /* Minimum bytes allocated between two collections */
+#define GC_NURSERY_RATIO 4                  /* Nursery grows to 1/4th of the heap for larger heaps */
+
+/* Defaults of the tunable heuristics, which can be changed with the MEGA_GC_GROWTH, 
+ * MEGA_GC_MIN_HEAP, MEGA_GC_MAX_HEAP and MEGA_GC_MODE environment variables, the 
+ * matching --gc-<option>=<value> flags, or by gcSetOption */ 
+
+#define GC_HEAP_GROW_FACTOR 2               /* Growth of the heap before the next full collection */
+#define GC_MIN_HEAP (1024 * 1024)           /* Heap size below which nothing is collected */
+#define GC_MAX_HEAP 0                       /* Heap size which is never exceeded, 0 for no limit */
+
+/* Runs incremental collections instead of generational ones, which bounds 
+ * the pause times by splitting every collection into small slices */ 
+
+// #define GC_INCREMENTAL
+
+#define GC_STEP_SIZE (64 * 1024)            /* Bytes allocated between two slices */
+#define GC_STEP_UNITS 1024                  /* Objects blackened or swept by a slice */
+#define GC_STEP_MICROS 0                    /* Time limit of a slice in microseconds, 0 for none */
 
 void collectGarbage(VM* vm);
+void gcCollect(VM* vm);
+bool gcStep(VM* vm, int units);
+bool gcSetOption(VM* vm, const char* name, const char* value);
+void gcReadEnvironment(VM* vm);
 void markRoots(VM* vm);
 void markArray(VM* vm, ValueArray* array);
 void markValue(VM* vm, Value val);
 void markObject(VM* vm, Obj* obj);
 void markTable(VM* vm, Table* table);
+void markWeakTable(VM* vm, ObjTable* table);
 void markPtrTable(VM* vm, PtrTable* table);
+void gcRemember(VM* vm, Obj* obj);
 
 void sweep(VM* vm);
+void gcSweepStep(VM* vm);
+void gcSweepPage(void* vm, PoolPage* page);
 void clearTableWeakref(VM* vm, Table* table);
+void blackenObject(VM* vm, Obj* obj);
 void traceObjects(VM* vm);
 
+/* Mark and generation bits 
+ *
+ * Objects live in the pages of vm->objects, whose side bitmaps hold the mark 
+ * and old bits of every object. Marking never writes to the objects themselves, 
+ * so pages of old objects stay clean (and shared after a fork) */ 
+
+static inline bool gcIsMarked(Obj* obj) {
+    PoolPage* page = poolPageOf(obj);
+    return POOL_TEST_BIT(page->marked, poolIndexOf(page, obj));
+}
+
+static inline void gcSetMarked(Obj* obj) {
+    PoolPage* page = poolPageOf(obj);
+    POOL_SET_BIT(page->marked, poolIndexOf(page, obj));
+}
+
+static inline bool gcIsOld(Obj* obj) {
+    PoolPage* page = poolPageOf(obj);
+    return POOL_TEST_BIT(page->old, poolIndexOf(page, obj));
+}
+
+/* Write barriers 
+ *
+ * An old object is not traced by a minor collection, so if it gets a reference 
+ * to a young object stored into it, it has to be added to the remembered set 
+ * which the minor collection treats as roots. While an incremental cycle is 
+ * marking, a value stored into an already marked object is marked as well. 
+ * Every store of a value into an existing heap object (table, array, upvalue, 
+ * closure, ect) must be followed by a barrier */ 
+
+static inline void gcWriteBarrier(VM* vm, Obj* object, Value value) {
+    if (!CHECK_OBJ(value)) return;
+    Obj* target = AS_OBJ(value);
+
+    if (gcIsOld(object)) {
+        if (!object->isRemembered && !gcIsOld(target)) gcRemember(vm, object);
+    } else if (vm->gcPhase == GC_PHASE_MARK && gcIsMarked(object) && !gcIsMarked(target)) {
+        markObject(vm, target);
+    }
+}
+
+/* Table stores can add a new key as well as a value */ 
+static inline void gcWriteBarrierEntry(VM* vm, Obj* object, Value key, Value value) {
+    gcWriteBarrier(vm, object, key);
+    gcWriteBarrier(vm, object, value);
+}
+
+/* For bulk stores (copying tables, saving stacks) where checking 
+ * every single value isn't worth it */ 
+static inline void gcWriteBarrierAll(VM* vm, Obj* object) {
+    if (gcIsOld(object)) {
+        if (!object->isRemembered) gcRemember(vm, object);
+    } else if (vm->gcPhase == GC_PHASE_MARK && gcIsMarked(object)) {
+        blackenObject(vm, object);
+    }
+}
+
 #endif 
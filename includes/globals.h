@@ -13,5 +13,7 @@ bool msglobal_clock(VM* vm, int argCount, bool shouldReturn);
 bool msglobal_type(VM* vm, int argCount, bool shouldReturn);
 bool msglobal_input(VM* vm, int argCount, bool shouldReturn);
 bool msglobal_char(VM* vm, int argCount, bool shouldReturn);
+bool msglobal_weaktable(VM* vm, int argCount, bool shouldReturn);
+bool msglobal_remove(VM* vm, int argCount, bool shouldReturn);
 
 #endif
@@ -0,0 +1,58 @@
+#ifndef ms_heapprof_h
+#define ms_heapprof_h
+#include <stdio.h>
+#include "../includes/vm.h"
+#include "../includes/object.h"
+
+/* Heap snapshots and the allocation site profiler
+ *
+ * A heap snapshot runs a full collection and writes every object left on the
+ * heap to a text file, one line per object:
+ *
+ *     object <id> <type> <bytes> <site> <ids of the objects it references...>
+ *
+ * Ids are the addresses of the objects in hex, bytes count the object and the
+ * memory it owns (table entries, array storage, bytecode). A "roots" line lists
+ * the objects the vm references directly, and "site <number> <function> <line>"
+ * lines name the allocation sites used by the objects.
+ *
+ * While the profiler runs, every object is tagged with the function and line
+ * which allocated it, kept in a side array of its pool page. Site 0 stands for
+ * objects allocated by the vm itself or before the profiler was started. The
+ * report lists the sites which retain the most live bytes, and the ones which
+ * allocated the most. Both are available with the --heap-snapshot=<file> and
+ * --alloc-profile flags, which act when the script finished, and through
+ * the gc module */
+
+typedef struct {
+    char* function;                 /* Copy of the name, the function can be collected */
+    uint32_t hash;
+    int line;
+    size_t count;                   /* Objects allocated here */
+    size_t bytes;
+} AllocSite;
+
+struct HeapProfiler {
+    AllocSite* sites;
+    int siteCount;
+    int siteCapacity;
+    int* slots;                     /* Open addressing index into sites, 0 for empty slots */
+    int slotCapacity;
+};
+
+typedef struct {
+    int site;
+    size_t liveCount;               /* Objects of the site still on the heap */
+    size_t liveBytes;
+} SiteUsage;
+
+void startProfiler(VM* vm);
+void stopProfiler(VM* vm);
+void profileAllocation(VM* vm, Obj* obj, size_t size);
+SiteUsage* measureSites(VM* vm, int* count);         /* Sorted by live bytes, freed by the caller */
+void writeProfileReport(VM* vm, FILE* file, int top);
+
+size_t heapObjectSize(Obj* obj);
+long writeHeapSnapshot(VM* vm, const char* path);   /* Objects written, -1 if the file couldn't be written */
+
+#endif
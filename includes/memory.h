@@ -9,19 +9,33 @@
 #define GROW_CAPACITY(capacity) \
 ((capacity) < THRESHOLD ? THRESHOLD : (capacity) * 2)
 
-#define GROW_ARRAY(datatype, array, oldS, newS) \
-(datatype*)reallocateArray(array, (oldS) * sizeof(datatype), (newS) * sizeof(datatype))
+#define GROW_ARRAY(category, datatype, array, oldS, newS) \
+(datatype*)reallocateArray(category, array, (oldS) * sizeof(datatype), (newS) * sizeof(datatype))
 
-#define FREE_ARRAY(datatype, array, oldS) reallocateArray(array, (oldS) * sizeof(datatype), 0)
+#define FREE_ARRAY(category, datatype, array, oldS) reallocateArray(category, array, (oldS) * sizeof(datatype), 0)
 
 #define ALLOCATE(vmptr, type, count) \
     (type*)reallocate(vmptr, NULL, 0, sizeof(type) * count)
 
-#define ALLOCATE_ARRAY(type, count) \
-    (type*)reallocateArray(NULL, 0, sizeof(type) * count)
+#define ALLOCATE_ARRAY(category, type, count) \
+    (type*)reallocateArray(category, NULL, 0, sizeof(type) * count)
+
+/* Every allocation is accounted to a category of the vm, the vm collects 
+ * once the sum of all of them reaches its threshold. 
+ *
+ * reallocate and reallocateCategory may run a collection, so anything they 
+ * allocate for must be reachable already. reallocateArray is used by code which 
+ * has no vm at hand (tables, chunks, value arrays) and can't know whether 
+ * collecting is safe, so it never collects, its bytes are accounted to the 
+ * vm the calling thread set with setAccountingVM and only trigger the next 
+ * safe collection */ 
 
 void* reallocate(VM* vm, void* array, size_t oldSize, size_t newSize);
-void* reallocateArray(void* array, size_t oldSize, size_t newSize);
+void* reallocateCategory(VM* vm, MemoryCategory category, void* array, size_t oldSize, size_t newSize);
+void* reallocateArray(MemoryCategory category, void* array, size_t oldSize, size_t newSize);
+void setAccountingVM(VM* vm);
+void* allocateBlock(VM* vm, Pool* pool, MemoryCategory category, size_t size);      /* Objects and small blocks from a pool */
+void freeBlock(VM* vm, Pool* pool, MemoryCategory category, void* block, size_t size);
 
 #endif
 
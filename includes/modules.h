@@ -0,0 +1,21 @@
+#ifndef ms_modules_h
+#define ms_modules_h
+#include "../includes/object.h"
+
+/* Native modules linked into the executable
+ *
+ * Building with 'make STATIC_MODULES=1' compiles the modules of core into the 
+ * executable with MS_BUILTIN_MODULES defined, instead of building them as 
+ * shared libraries. Importing one of them ("lib/_socket") then gives a dll 
+ * object without a handle, whose natives are registered from the table of 
+ * the module (see msapi.h), so nothing is loaded. A normal build has no 
+ * builtin modules */
+
+typedef struct {
+    const char* path;                           /* As imported, without the extension */
+    const NativeModuleFunction* functions;
+} BuiltinModule;
+
+const NativeModuleFunction* findBuiltinModule(const char* path);
+
+#endif
@@ -2,6 +2,7 @@
 #define ms_msapi_h
 
 #include "../includes/vm.h"
+#include "../includes/object.h"
 /*          API             */ 
 void msapi_runtimeError(VM* vm, const char* format, ...); 
 bool msapi_isFalsey(Value value);
@@ -15,4 +16,30 @@ void msapi_popn(VM* vm, unsigned int count);
 Value msapi_getArg(VM* vm, int number, int argCount);
 ObjUpvalue* msapi_closeUpvalues(VM* vm, Value* slot);
 bool msapi_callClosure(VM* vm, ObjClosure* closure, bool shouldReturn, int argCount, bool isCoroutine);
+bool msapi_call(VM* vm, int argCount);
+
+/*      Native modules      */ 
+/* A shared library registers its natives by exporting 
+ *
+ *     const NativeModuleFunction* msmodule_register();
+ *
+ * which returns a table of their names, functions and arities, ended by 
+ * {NULL, NULL, 0}. The vm creates the natives once when the library is 
+ * imported, and they are then found with query() or called directly 
+ * (library.function()) without any dlsym. Libraries which don't export 
+ * it are still queried with dlsym.
+ *
+ * MS_REGISTER_MODULE(table) defines the function. The modules of core pass 
+ * their table to the vm directly when they are linked into the executable 
+ * (make STATIC_MODULES=1, see modules.h), so it is left out then */ 
+#define MS_REGISTER_SYMBOL "msmodule_register"
+
+typedef const NativeModuleFunction* (*NativeModuleRegister)();
+
+#ifdef MS_BUILTIN_MODULES
+    #define MS_REGISTER_MODULE(table)
+#else
+    #define MS_REGISTER_MODULE(table) \
+        const NativeModuleFunction* msmodule_register() { return table; }
+#endif
 #endif
@@ -10,6 +10,12 @@
 typedef bool (*NativeFuncPtr)(VM*, int, bool);
 typedef bool (*NativeMethodPtr)(VM*, Obj*, int, bool);
 
+typedef struct {
+    const char* name;
+    NativeMethodPtr function;
+    int arity;                          /* The fewest arguments it takes */
+} NativeModuleFunction;                 /* Natives a module registers, see msapi.h */
+
 typedef enum {
     CORO_RUNNING,
     CORO_YIELDING,
@@ -135,8 +141,8 @@ typedef enum {
 struct Obj {                /* Typedef defined in value.h */
     ObjType type;
     uint32_t hash;
-    bool isMarked; 
-    Obj* next;
+    bool isRemembered;      /* Old object in the remembered set, the mark and generation 
+                               bits are kept in the bitmaps of the objects pool page */
 };
 
 struct ObjString {
@@ -200,8 +206,22 @@ struct ObjMethod {
 };
 
 
+/* Weak tables don't keep some of their contents alive, the collector removes 
+ * the entries whose weak key or value died. In an ephemeron table the value 
+ * is only kept alive as long as the key is. Strings and other non objects
+ * are never weak */
+typedef enum {
+    TABLE_STRONG,
+    TABLE_WEAK_KEYS,
+    TABLE_WEAK_VALUES,
+    TABLE_EPHEMERON
+} TableMode;
+
 struct ObjTable {
     OBJ_HEAD;
+    TableMode mode;
+    bool weakListed;              /* Already in the weak tables of the running collection */
+    ObjTable* nextWeak;
     Table table;
 };
 
@@ -210,6 +230,7 @@ struct ObjNativeMethod {
     ObjString* name;
     Obj* self;
     NativeMethodPtr function;
+    int arity;                          /* Fewest arguments, checked before the call */
 };
 
 struct ObjDllContainer {
@@ -217,6 +238,7 @@ struct ObjDllContainer {
     ObjString* fileName;
     bool closed;
     void* handle;
+    ObjTable* natives;                  /* Registered natives, NULL if they are queried with dlsym */
 };
 
 struct ObjSocket {
@@ -259,6 +281,7 @@ ObjInstance* allocateInstance(VM* vm, ObjClass* klass);
 ObjNativeMethod* allocateNativeMethod(VM* vm, ObjString* name, Obj* self, NativeMethodPtr methodPtr);
 ObjMethod* allocateMethod(VM* vm, ObjInstance* instance, ObjClosure* closure);
 ObjTable* allocateTable(VM* vm);
+ObjTable* allocateWeakTable(VM* vm, TableMode mode);
 ObjDllContainer* allocateDllContainer(VM* vm, ObjString* fileName, void* handle);
 ObjSocket* allocateSocket(VM* vm, int sockfd);
 ObjSSocket* allocateSSocket(VM* vm, SSOCKET* ssocket);
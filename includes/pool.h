@@ -0,0 +1,102 @@
+#ifndef ms_pool_h
+#define ms_pool_h
+
+#include "../includes/common.h"
+
+/* Pool allocator for objects and other small blocks
+ *
+ * Blocks up to POOL_MAX_SIZE bytes are rounded up to a size class and carved
+ * out of pages which only hold that class, larger blocks get a page of their
+ * own. Pages are aligned to POOL_PAGE_SIZE, so the page of any block is found
+ * by masking its address. Freed blocks are threaded onto the free list of
+ * their page, and pages which end up empty are given back to the OS by poolTrim.
+ *
+ * Every page keeps side bitmaps with one bit per POOL_GRANULE bytes, set for
+ * the first granule of a block: which blocks are allocated, and the mark and
+ * generation bits of the collector. Marking and sweeping only touch these
+ * bitmaps instead of the objects themselves. 
+ *
+ * Pages flagged unswept hold garbage a lazy sweeper hasn't freed yet, the 
+ * sweeper hook of the pool is called on such a page before a block is 
+ * allocated from it, so new blocks never end up among unswept garbage */
+
+#define POOL_PAGE_SIZE (64 * 1024)
+#define POOL_GRANULE 16
+#define POOL_SMALL_SIZE 256                 /* Classes up to here are POOL_GRANULE apart */
+#define POOL_MAX_SIZE 4096
+#define POOL_CLASSES 32
+#define POOL_LARGE -1                       /* Size class of pages holding a single large block */
+#define POOL_BITMAP_WORDS (POOL_PAGE_SIZE / POOL_GRANULE / 64)
+
+typedef struct PoolPage PoolPage;
+
+struct PoolPage {
+    PoolPage* next;             /* Pages in the same free space list */
+    PoolPage* prev;
+    PoolPage* nextPage;         /* Every page of the pool */
+    PoolPage* prevPage;
+    void* freeList;             /* Freed blocks */
+    char* bump;                 /* Start of the blocks which were never handed out */
+    char* end;
+    size_t mapSize;             /* Bytes mapped for this page */
+    int sizeClass;
+    int blockSize;
+    int used;                   /* Blocks currently handed out */
+    int capacity;
+    bool unswept;               /* Still has to be visited by the running sweep */
+    uint32_t* sites;            /* Allocation site of every block while a heap profile is taken */
+
+    uint64_t allocated[POOL_BITMAP_WORDS];
+    uint64_t marked[POOL_BITMAP_WORDS];
+    uint64_t old[POOL_BITMAP_WORDS];
+};
+
+typedef void (*PoolSweepFn)(void* data, PoolPage* page);
+
+typedef struct {
+    PoolSweepFn sweeper;                /* Sweeps an unswept page, must clear the flag */
+    void* sweeperData;
+    PoolPage* partial[POOL_CLASSES];    /* Pages with at least one free block */
+    PoolPage* full[POOL_CLASSES];
+    PoolPage* empty;                    /* Pages waiting to be unmapped */
+    PoolPage* pages;
+    size_t pageCount;
+} Pool;
+
+void initPool(Pool* pool);
+void freePool(Pool* pool);
+void* poolAlloc(Pool* pool, size_t size);
+void poolFree(Pool* pool, void* block);        /* The size class is taken from the page */
+void poolTrim(Pool* pool);
+
+static inline PoolPage* poolPageOf(const void* block) {
+    return (PoolPage*)((uintptr_t)block & ~(uintptr_t)(POOL_PAGE_SIZE - 1));
+}
+
+static inline int poolIndexOf(const PoolPage* page, const void* block) {
+    return (int)(((const char*)block - (const char*)page) / POOL_GRANULE);
+}
+
+static inline void* poolBlockAt(const PoolPage* page, int index) {
+    return (char*)page + (size_t)index * POOL_GRANULE;
+}
+
+#define POOL_TEST_BIT(bitmap, index) (((bitmap)[(index) >> 6] >> ((index) & 63)) & 1)
+#define POOL_SET_BIT(bitmap, index) ((bitmap)[(index) >> 6] |= (uint64_t)1 << ((index) & 63))
+#define POOL_CLEAR_BIT(bitmap, index) ((bitmap)[(index) >> 6] &= ~((uint64_t)1 << ((index) & 63)))
+
+/* Index of the lowest set bit, word must not be 0 */
+static inline int countTrailingZeros(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(word);
+#else
+    int count = 0;
+    while ((word & 1) == 0) {
+        word >>= 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+#endif
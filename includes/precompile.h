@@ -0,0 +1,41 @@
+#ifndef ms_precompile_h
+#define ms_precompile_h
+#include "../includes/vm.h"
+#include "../includes/object.h"
+
+/* Parallel compilation of imports
+ *
+ * Before the main script runs, its source is scanned for import statements
+ * with a string path, and so are the sources of the scripts they resolve to,
+ * until the whole graph of statically imported scripts is known. They are
+ * then compiled at once by a pool of threads, each with a vm of its own which
+ * only serves as the arena of the compiler and is freed once the thread is
+ * done. What a thread keeps of a script is its bytecode in the format of the
+ * cache files (see bytecache.h), and only when the import runs is the function
+ * loaded from it into the heap of the real vm. Scripts which fail to compile
+ * are left to the import, so that the error is reported where it would have
+ * been without the pre-pass.
+ *
+ * The thread count comes from the MEGA_COMPILE_THREADS environment variable,
+ * 0 starts one thread per core. The pre-pass is off unless it is set above 1,
+ * and it needs pthreads, elsewhere every import compiles its script itself */
+
+#if !defined(_WIN32) && (defined(__GNUC__) || defined(__clang__))
+#define PARALLEL_COMPILE
+#endif
+
+#define COMPILE_MAX_THREADS 64
+
+struct PrecompiledModule {
+    char* path;                         /* As resolved by the import */
+    char* source;                       /* Only held during the pre-pass */
+    size_t sourceLength;
+    uint8_t* bytecode;                  /* NULL if it wasn't compiled */
+    size_t length;
+};
+
+void precompileImports(VM* vm, const char* source);
+bool loadPrecompiled(VM* vm, const char* path, ObjFunction* function);     /* Returns false if it wasn't precompiled */
+void freePrecompiled(VM* vm);
+
+#endif
@@ -1,6 +1,14 @@
 #ifndef ms_scanner_h
 #define ms_scanner_h
 
+/* Runs of whitespace and the bodies of comments and strings are searched 16
+ * bytes at a time with SSE2 where the compiler has it, elsewhere a byte at a
+ * time. Identifiers are classified with a table and keywords with a perfect
+ * hash, see scanner.c */
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+#define SCANNER_SIMD
+#endif
+
 typedef struct {
     int line;
     const char* start;
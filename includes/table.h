@@ -6,27 +6,38 @@
 
 #define MAX_LOAD_FACTOR 0.6
 
+/* Hash tables keep a control byte with 7 bits of the hash for every slot, so a probe 
+ * can check a whole group of 16 slots at once. With this defined and SSE2 available 
+ * the group is compared in a single instruction, otherwise one byte at a time */
+#define TABLE_SIMD_PROBING
+#define TABLE_USABLE(capacity) ((int)((capacity) * MAX_LOAD_FACTOR))     /* Entries a table can hold */
+#define TABLE_TOMBSTONES(table) ((table)->entryCount - (table)->count)   /* Deleted entries not yet reclaimed */
+
 
 typedef struct {
-    ObjString* key;
+    Value key;                  /* nil for deleted entries */
     Value value;
 } Entry;
 
 typedef struct {
-    int capacity;
-    int count;
-    Entry* entries;
+    int capacity;               /* Slots in the index, always a power of 2 */
+    int count;                  /* Live entries in the hash part */
+    int entryCount;             /* Used entries, deleted ones included */
+    uint8_t* ctrl;              /* Control bytes for the slots */
+    void* index;                /* Slots pointing into 'entries', 8, 16 or 32 bits wide depending on the capacity */
+    Entry* entries;             /* Hash part in insertion order, deleted entries have a nil key */
+    ValueArray array;           /* Array part, slot 'i' holds the integer key 'i', nil slots are absent keys */
 } Table;
 
 typedef struct {
     ObjString* key;
     void* value;
-    bool tombstone;
 } PtrEntry;
 
 typedef struct {
     int capacity;
     int count;
+    uint8_t* ctrl;              /* Control bytes for the slots */
     PtrEntry* entries;
 } PtrTable;
 
@@ -39,9 +50,17 @@ void initTable(Table* table);
 bool insertTable(Table* table, ObjString* key, Value value);
 bool deleteTable(Table* table, ObjString* key);
 void copyTableAll(Table* from, Table* to);
+void compactTable(Table* table);                                    /* Reclaims deleted entries, call after deleting */
 bool getTable(Table* table, ObjString* key, Value* value);          /* Value is the output paramater */
 
+/* Variants taking any hashable value as the key, the key must not be nil or NaN */
+bool isValidTableKey(Value key);
+bool insertValueTable(Table* table, Value key, Value value);
+bool deleteValueTable(Table* table, Value key);
+bool getValueTable(Table* table, Value key, Value* value);
+
 ObjString* findStringTable(Table* table, char* chars, int length, uint32_t hash);   /* Used for string interning */
 void freeTable(Table* table);
+size_t tableMemory(Table* table);                                   /* Bytes held by the table besides the struct */
 uint32_t hash_string(const char* string, int length);
 #endif
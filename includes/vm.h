@@ -4,6 +4,7 @@
 #include "../includes/value.h"
 #include "../includes/table.h"
 #include "../includes/chunk.h"
+#include "../includes/pool.h"
 #include <stdint.h>
 #define LVAR_MAX 256
 #define UPVAL_MAX 256
@@ -11,6 +12,17 @@
 #define STACK_MAX LVAR_MAX * FRAME_MAX
 #define IMPORT_CYCLE_MAX 50
 
+#ifdef _WIN32
+#define MEGPATH_SEPARATOR ';'
+#else
+#define MEGPATH_SEPARATOR ':'
+#endif
+
+typedef struct GCMarker GCMarker;
+typedef struct Finalizer Finalizer;
+typedef struct HeapProfiler HeapProfiler;
+typedef struct PrecompiledModule PrecompiledModule;
+
 typedef struct {
     int count;
     int capacity;
@@ -34,11 +46,36 @@ typedef struct {
     ObjTable* globals;
     ObjStringArray customGlobals;
     ObjString* moduleName;
+    ObjString* modulePath;          /* Resolved path, the key of the import cache */
 } Module;
 
+typedef enum {
+    MEMORY_OBJECTS,               /* Objects other than strings */
+    MEMORY_STRINGS,
+    MEMORY_ARRAYS,                /* Storage of arrays, array parts of tables and constants */
+    MEMORY_TABLES,                /* Entries, index and control bytes of tables */
+    MEMORY_BYTECODE,
+    MEMORY_COROUTINES,            /* Saved frames and stacks */
+    MEMORY_COLLECTOR,             /* Grey stack and remembered set */
+    MEMORY_OTHER,
+    MEMORY_CATEGORIES
+} MemoryCategory;
+
+typedef enum {
+    GC_MODE_GENERATIONAL,
+    GC_MODE_INCREMENTAL
+} GCMode;
+
+typedef enum {
+    GC_PHASE_PAUSE,               /* No incremental cycle is running */
+    GC_PHASE_MARK,
+    GC_PHASE_SWEEP
+} GCPhase;
+
 typedef struct {
     CallFrame frames[FRAME_MAX];
     int frameCount;
+    int callBoundary;             /* Frame count below which a nested native call started */
     Value stack[STACK_MAX];       /* Stack */
     Obj** greyStack;
     int greyCount;
@@ -54,15 +91,49 @@ typedef struct {
     PtrTable tableMethods;
     PtrTable dllMethods;
 
-    Obj* ObjHead;                 /* Used for tracking the object linked list */
+    Obj** remembered;             /* Old objects which were written young references */
+    int rememberedCount;
+    int rememberedCapacity;
     ObjUpvalue* UpvalueHead;
-    size_t bytesAllocated;
-    size_t nextGC;
+    Pool objects;                 /* Memory of the objects, which the collector sweeps */
+    Pool blocks;                  /* Small blocks owned by objects */
+    size_t bytesAllocated;        /* Every byte the vm allocated, the sum of memory[] */
+    size_t memory[MEMORY_CATEGORIES];
+    size_t nextGC;                /* Next collection, normally a minor one */
+    size_t nextFullGC;            /* Size of the old generation which triggers a full collection */
+    bool minorGC;                 /* Whether the running collection only traces young objects */
+    GCMode gcMode;
+    GCPhase gcPhase;              /* Progress of the incremental cycle */
+    PoolPage* sweepPage;          /* Next page the sweeper visits */
+    size_t gcStepSize;            /* Bytes allocated between two incremental slices */
+    int gcStepUnits;              /* Work budget of a slice */
+    int gcStepMicros;             /* Time budget of a slice, 0 if unlimited */
+    int gcMarkThreads;            /* Threads tracing a collection */
+    double gcGrowFactor;
+    size_t gcMinHeap;
+    size_t gcMaxHeap;             /* 0 if the heap can grow without limit */
+    bool gcEnabled;               /* Cleared while a script stops the collector */
+    size_t gcCollections;         /* Finished cycles */
+    size_t gcFullCollections;
+    GCMarker* marker;             /* Helper threads of the parallel marker */
+    ObjTable* weakTables;         /* Weak tables traced by the running collection */
+    Finalizer* finalizers;        /* Resources of collected objects, waiting to be closed */
+    int finalizerCount;
+    int finalizerCapacity;
+    size_t gcFinalized;           /* Resources closed by finalizers */
+    HeapProfiler* profiler;       /* Allocation site profiler, NULL unless it was started */
     bool running;
+    bool silentErrors;            /* Compile errors aren't printed, set on the vms of the parallel compiler */
 
-    Table importCache;
+    Table importCache;            /* Tables of the imported scripts, by resolved path */
+    Table resolvedImports;        /* Import strings to the path they resolved to, or false */
+    char** searchPaths;           /* Directories of MEGPATH, parsed once */
+    int searchPathCount;
     Module modules[IMPORT_CYCLE_MAX];
     int moduleCount;
+    PrecompiledModule* precompiled;   /* Imports compiled ahead of time, see precompile.h */
+    int precompiledCount;
+    int precompiledCapacity;
 } VM;
 
 
@@ -79,7 +150,17 @@ InterpretResult interpret(VM* vm, ObjFunction* function);
 void resetStack(VM* vm);
 
 char* findFile(VM* vm, char* path, bool genErr); 
+ObjString* resolveImport(VM* vm, ObjString* importPath);
 bool msmethod_array_insert(VM* vm, Obj* self, int argCount, bool shouldReturn); 
+bool msmethod_array_pop(VM* vm, Obj* self, int argCount, bool shouldReturn);
+bool msmethod_array_remove(VM* vm, Obj* self, int argCount, bool shouldReturn);
+bool msmethod_array_indexOf(VM* vm, Obj* self, int argCount, bool shouldReturn);
+bool msmethod_array_slice(VM* vm, Obj* self, int argCount, bool shouldReturn);
+bool msmethod_array_reserve(VM* vm, Obj* self, int argCount, bool shouldReturn);
+bool msmethod_array_sort(VM* vm, Obj* self, int argCount, bool shouldReturn);
+bool msmethod_array_map(VM* vm, Obj* self, int argCount, bool shouldReturn);
+bool msmethod_array_filter(VM* vm, Obj* self, int argCount, bool shouldReturn);
+bool msmethod_array_reduce(VM* vm, Obj* self, int argCount, bool shouldReturn);
 bool msmethod_string_capture(VM* vm, Obj* self, int argCount, bool shouldReturn);
 bool msmethod_string_split(VM* vm, Obj* self, int argCount, bool shouldReturn);
 bool msmethod_string_getAscii(VM* vm, Obj* self, int argCount, bool shouldReturn);
@@ -0,0 +1,544 @@
+#include "../includes/bytecache.h"
+#include "../includes/compiler.h"
+#include "../includes/chunk.h"
+#include "../includes/memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define BYTECODE_MAGIC "MEGC"
+#define HEADER_SIZE 40          /* magic 4, version 2, opcodes 1, main 1,
+                                   source size 8, mtime 8, hash 8, body hash 8 */
+
+typedef enum {
+    CONSTANT_NIL,
+    CONSTANT_FALSE,
+    CONSTANT_TRUE,
+    CONSTANT_NUMBER,
+    CONSTANT_STRING,
+    CONSTANT_FUNCTION
+} ConstantTag;
+
+typedef struct {
+    uint64_t size;
+    int64_t mtime;
+    uint64_t hash;
+} SourceStamp;
+
+typedef struct {
+    uint8_t* bytes;
+    size_t count;
+    size_t capacity;
+} Writer;
+
+typedef struct {
+    VM* vm;
+    const uint8_t* current;
+    const uint8_t* end;
+    bool failed;
+} Reader;
+
+static uint64_t hashBytes(const uint8_t* bytes, size_t length) {
+    /* 64 bit FNV-1a */
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/* - - - - - - - - Writing - - - - - - - - */
+
+static void writeBytes(Writer* writer, const void* bytes, size_t length) {
+    if (writer->count + length > writer->capacity) {
+        size_t capacity = writer->capacity < 256 ? 256 : writer->capacity;
+        while (capacity < writer->count + length) capacity *= 2;
+
+        writer->bytes = GROW_ARRAY(MEMORY_OTHER, uint8_t, writer->bytes, writer->capacity, capacity);
+        writer->capacity = capacity;
+    }
+
+    memcpy(writer->bytes + writer->count, bytes, length);
+    writer->count += length;
+}
+
+static void writeInteger(Writer* writer, uint64_t value, int size) {
+    /* Integers are always little endian */
+    uint8_t bytes[8];
+
+    for (int i = 0; i < size; i++) {
+        bytes[i] = (uint8_t)(value >> (i * 8));
+    }
+
+    writeBytes(writer, bytes, size);
+}
+
+static void writeString(Writer* writer, ObjString* string) {
+    writeInteger(writer, string->length, 4);
+    writeBytes(writer, string->allocated, string->length);
+}
+
+static bool writeFunction(Writer* writer, ObjFunction* function) {
+    if (function->name != NULL) {
+        writeString(writer, function->name);
+    } else {
+        writeInteger(writer, 0, 4);
+    }
+
+    writeInteger(writer, function->arity, 4);
+    writeInteger(writer, function->upvalueCount, 4);
+    writeInteger(writer, function->variadic, 1);
+
+    Chunk* chunk = &function->chunk;
+    writeInteger(writer, chunk->elem_count, 4);
+    writeBytes(writer, chunk->code, chunk->elem_count);
+
+    /* Lines are written as runs of bytes with the same line */
+    writeInteger(writer, chunk->lineCount, 4);
+    for (int i = 0; i < chunk->lineCount; i++) {
+        int end = i + 1 < chunk->lineCount ? chunk->lines[i + 1].offset : chunk->elem_count;
+
+        writeInteger(writer, end - chunk->lines[i].offset, 4);
+        writeInteger(writer, (uint32_t)chunk->lines[i].line, 4);
+    }
+
+    writeInteger(writer, chunk->constants.count, 4);
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value value = chunk->constants.values[i];
+
+        if (CHECK_NIL(value)) {
+            writeInteger(writer, CONSTANT_NIL, 1);
+        } else if (CHECK_BOOLEAN(value)) {
+            writeInteger(writer, AS_BOOL(value) ? CONSTANT_TRUE : CONSTANT_FALSE, 1);
+        } else if (CHECK_NUMBER(value)) {
+            uint64_t bits;
+            double number = AS_NUMBER(value);
+            memcpy(&bits, &number, sizeof(bits));
+
+            writeInteger(writer, CONSTANT_NUMBER, 1);
+            writeInteger(writer, bits, 8);
+        } else if (CHECK_STRING(value)) {
+            writeInteger(writer, CONSTANT_STRING, 1);
+            writeString(writer, AS_STRING(value));
+        } else if (CHECK_FUNCTION(value)) {
+            writeInteger(writer, CONSTANT_FUNCTION, 1);
+            if (!writeFunction(writer, AS_FUNCTION(value))) return false;
+        } else {
+            /* The compiler doesn't emit anything else, but a
+             * constant we don't know can't be cached */
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void writeHeader(Writer* writer, const SourceStamp* stamp, bool isMain, uint64_t bodyHash) {
+    writeBytes(writer, BYTECODE_MAGIC, 4);
+    writeInteger(writer, BYTECODE_VERSION, 2);
+    writeInteger(writer, OP_RETEOF + 1, 1);
+    writeInteger(writer, isMain, 1);
+    writeInteger(writer, stamp->size, 8);
+    writeInteger(writer, (uint64_t)stamp->mtime, 8);
+    writeInteger(writer, stamp->hash, 8);
+    writeInteger(writer, bodyHash, 8);
+}
+
+static void storeCache(const char* cachePath, const SourceStamp* stamp, const Writer* body, bool isMain) {
+    Writer header = {NULL, 0, 0};
+    writeHeader(&header, stamp, isMain, hashBytes(body->bytes, body->count));
+
+    /* The file is written under a temporary name first, so that another
+     * process never reads it half written. Failing to write the cache
+     * (a read only directory for example) is not an error */
+    size_t tempLength = strlen(cachePath) + 5;
+    char* tempPath = ALLOCATE_ARRAY(MEMORY_OTHER, char, tempLength);
+    strcpy(tempPath, cachePath);
+    strcat(tempPath, ".tmp");
+
+    FILE* file = fopen(tempPath, "wb");
+
+    if (file != NULL) {
+        bool written = fwrite(header.bytes, 1, header.count, file) == header.count
+                    && fwrite(body->bytes, 1, body->count, file) == body->count;
+        written = fclose(file) == 0 && written;
+
+        if (!written) {
+            remove(tempPath);
+        } else if (rename(tempPath, cachePath) != 0) {
+            /* rename doesn't replace an existing file everywhere */
+            remove(cachePath);
+            if (rename(tempPath, cachePath) != 0) remove(tempPath);
+        }
+    }
+
+    FREE_ARRAY(MEMORY_OTHER, char, tempPath, tempLength);
+    FREE_ARRAY(MEMORY_OTHER, uint8_t, header.bytes, header.capacity);
+}
+
+/* - - - - - - - - Reading - - - - - - - - */
+
+static const uint8_t* readBytes(Reader* reader, size_t length) {
+    if (reader->failed || (size_t)(reader->end - reader->current) < length) {
+        reader->failed = true;
+        return NULL;
+    }
+
+    const uint8_t* bytes = reader->current;
+    reader->current += length;
+    return bytes;
+}
+
+static uint64_t readInteger(Reader* reader, int size) {
+    const uint8_t* bytes = readBytes(reader, size);
+    uint64_t value = 0;
+
+    if (bytes == NULL) return 0;
+
+    for (int i = 0; i < size; i++) {
+        value |= (uint64_t)bytes[i] << (i * 8);
+    }
+
+    return value;
+}
+
+static ObjString* readString(Reader* reader) {
+    uint32_t length = (uint32_t)readInteger(reader, 4);
+    const uint8_t* chars = readBytes(reader, length);
+
+    if (chars == NULL) return NULL;
+    return allocateString(reader->vm, (const char*)chars, length);
+}
+
+static bool readFunction(Reader* reader, ObjFunction* function) {
+    /* The name has been read by the caller */
+    function->arity = (int)readInteger(reader, 4);
+    function->upvalueCount = (int)readInteger(reader, 4);
+    function->variadic = readInteger(reader, 1) != 0;
+
+    uint32_t count = (uint32_t)readInteger(reader, 4);
+    const uint8_t* code = readBytes(reader, count);
+
+    if (code == NULL || count == 0 || count > INT32_MAX) return false;
+
+    Chunk* chunk = &function->chunk;
+    chunk->code = ALLOCATE_ARRAY(MEMORY_BYTECODE, uint8_t, count);
+    chunk->capacity = count;
+    chunk->elem_count = count;
+    memcpy(chunk->code, code, count);
+
+    /* Every run starts a line entry, so there can't be more runs than bytes */
+    uint32_t runs = (uint32_t)readInteger(reader, 4);
+    if (reader->failed || runs == 0 || runs > count) return false;
+
+    chunk->lines = ALLOCATE_ARRAY(MEMORY_BYTECODE, LineStart, runs);
+    chunk->lineCapacity = runs;
+    uint32_t filled = 0;
+
+    for (uint32_t i = 0; i < runs && !reader->failed; i++) {
+        uint32_t length = (uint32_t)readInteger(reader, 4);
+        int line = (int)(uint32_t)readInteger(reader, 4);
+
+        if (length == 0 || length > count - filled) return false;
+        chunk->lines[chunk->lineCount].offset = filled;
+        chunk->lines[chunk->lineCount].line = line;
+        chunk->lineCount++;
+        filled += length;
+    }
+
+    if (reader->failed || filled != count) return false;
+
+    uint32_t constants = (uint32_t)readInteger(reader, 4);
+    if (constants > CONSTANT_MAX) return false;
+
+    for (uint32_t i = 0; i < constants && !reader->failed; i++) {
+        Value value;
+
+        switch ((ConstantTag)readInteger(reader, 1)) {
+            case CONSTANT_NIL: value = NIL(); break;
+            case CONSTANT_FALSE: value = NATIVE_TO_BOOLEAN(false); break;
+            case CONSTANT_TRUE: value = NATIVE_TO_BOOLEAN(true); break;
+            case CONSTANT_NUMBER: {
+                uint64_t bits = readInteger(reader, 8);
+                double number;
+                memcpy(&number, &bits, sizeof(number));
+                value = NATIVE_TO_NUMBER(number);
+                break;
+            }
+            case CONSTANT_STRING: {
+                ObjString* string = readString(reader);
+                if (string == NULL) return false;
+                value = OBJ(string);
+                break;
+            }
+            case CONSTANT_FUNCTION: {
+                ObjString* name = readString(reader);
+                if (name == NULL) return false;
+
+                ObjFunction* nested = allocateFunction(reader->vm, name, 0);
+                /* Adding it first keeps it reachable from the outer function */
+                writeValueArray(&chunk->constants, OBJ(nested));
+                if (!readFunction(reader, nested)) return false;
+                continue;
+            }
+            default: return false;
+        }
+
+        writeValueArray(&chunk->constants, value);
+    }
+
+    return !reader->failed;
+}
+
+static bool readModule(VM* vm, const uint8_t* bytes, size_t length, ObjFunction* function) {
+    Reader reader = {vm, bytes, bytes + length, false};
+    uint32_t nameLength = (uint32_t)readInteger(&reader, 4);
+
+    /* The outer function keeps the name it was given */
+    readBytes(&reader, nameLength);
+
+    if (!readFunction(&reader, function) || reader.current != reader.end) {
+        freeChunk(&function->chunk);
+        function->arity = 0;
+        function->upvalueCount = 0;
+        function->variadic = false;
+        return false;
+    }
+
+    return true;
+}
+
+static bool readHeader(FILE* file, const SourceStamp* stamp, bool isMain, uint8_t* headerBytes) {
+    if (fread(headerBytes, 1, HEADER_SIZE, file) != HEADER_SIZE) return false;
+
+    /* The header written for the source we have has to match byte for
+     * byte, except for the hash of the body which is checked after reading it */
+    Writer expected = {NULL, 0, 0};
+    writeHeader(&expected, stamp, isMain, 0);
+    bool current = memcmp(expected.bytes, headerBytes, HEADER_SIZE - 8) == 0;
+    FREE_ARRAY(MEMORY_OTHER, uint8_t, expected.bytes, expected.capacity);
+
+    return current;
+}
+
+static bool loadCache(VM* vm, const char* cachePath, const SourceStamp* stamp,
+                      ObjFunction* function, bool isMain) {
+    FILE* file = fopen(cachePath, "rb");
+    if (file == NULL) return false;
+
+    uint8_t headerBytes[HEADER_SIZE];
+    if (!readHeader(file, stamp, isMain, headerBytes)) {
+        fclose(file);
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long end = ftell(file);
+    size_t bodySize = end > HEADER_SIZE ? (size_t)(end - HEADER_SIZE) : 0;
+    fseek(file, HEADER_SIZE, SEEK_SET);
+
+    uint8_t* body = ALLOCATE_ARRAY(MEMORY_OTHER, uint8_t, bodySize);
+    bool read = bodySize > 0 && fread(body, 1, bodySize, file) == bodySize;
+    fclose(file);
+
+    Reader header = {vm, headerBytes + HEADER_SIZE - 8, headerBytes + HEADER_SIZE, false};
+    bool loaded = read && readInteger(&header, 8) == hashBytes(body, bodySize)
+               && readModule(vm, body, bodySize, function);
+
+    FREE_ARRAY(MEMORY_OTHER, uint8_t, body, bodySize);
+    return loaded;
+}
+
+/* - - - - - - - - - - - - - - - - - - - - */
+
+static char* cacheFile(const char* path) {
+    char* directory = getenv("MEGA_CACHE_DIR");
+    size_t pathLength = strlen(path);
+    char* chars;
+
+    if (directory != NULL && directory[0] != '\0') {
+        /* Files from every directory share the cache directory, so they are
+         * named after a hash of their absolute path, otherwise every main.meg
+         * run from its own directory would use the same file */
+#ifdef _WIN32
+        char* absolute = _fullpath(NULL, path, 0);
+#else
+        char* absolute = realpath(path, NULL);
+#endif
+        const char* named = absolute != NULL ? absolute : path;
+
+        chars = ALLOCATE_ARRAY(MEMORY_OTHER, char, strlen(directory) + 23);
+        sprintf(chars, "%s/%016llx.%s", directory,
+                (unsigned long long)hashBytes((const uint8_t*)named, strlen(named)), BYTECODE_EXTENSION);
+        free(absolute);
+    } else if (pathLength >= 4 && strcmp(path + pathLength - 4, ".meg") == 0) {
+        chars = ALLOCATE_ARRAY(MEMORY_OTHER, char, pathLength + 2);
+        strcpy(chars, path);
+        strcat(chars, "c");
+    } else {
+        chars = ALLOCATE_ARRAY(MEMORY_OTHER, char, pathLength + 6);
+        strcpy(chars, path);
+        strcat(chars, "." BYTECODE_EXTENSION);
+    }
+
+    return chars;
+}
+
+static bool stampSource(const char* path, const char* source, size_t length, SourceStamp* stamp) {
+    /* Returns false if the cache is turned off or can't be used for path */ 
+#ifdef BYTECODE_CACHE
+    char* enabled = getenv("MEGA_CACHE");
+    struct stat info;
+
+    if ((enabled != NULL && strcmp(enabled, "0") == 0) || stat(path, &info) != 0) return false;
+
+    stamp->size = length;
+    stamp->mtime = (int64_t)info.st_mtime;
+    stamp->hash = hashBytes((const uint8_t*)source, length);
+    return true;
+#else
+    return false;
+#endif
+}
+
+InterpretResult compileCached(VM* vm, const char* path, const char* source, size_t length,
+                              ObjFunction* function, bool isMain) {
+    SourceStamp stamp;
+
+    if (!stampSource(path, source, length, &stamp)) {
+        return compile(source, vm, function, isMain);
+    }
+
+    char* cachePath = cacheFile(path);
+    InterpretResult result = INTERPRET_OK;
+
+    if (!loadCache(vm, cachePath, &stamp, function, isMain)) {
+        result = compile(source, vm, function, isMain);
+
+        if (result == INTERPRET_OK) {
+            Writer body = {NULL, 0, 0};
+            if (writeFunction(&body, function)) storeCache(cachePath, &stamp, &body, isMain);
+            FREE_ARRAY(MEMORY_OTHER, uint8_t, body.bytes, body.capacity);
+        }
+    }
+
+    FREE_ARRAY(MEMORY_OTHER, char, cachePath, strlen(cachePath) + 1);
+    return result;
+}
+
+uint8_t* precompileModule(VM* vm, const char* path, const char* source, size_t length, size_t* bytecodeLength) {
+    SourceStamp stamp;
+    bool cached = stampSource(path, source, length, &stamp);
+    char* cachePath = cached ? cacheFile(path) : NULL;
+    uint8_t* bytecode = NULL;
+
+    /* An up to date cache file is loaded by the import itself, 
+     * faster than the bytecode could be copied over */ 
+    FILE* file = cached ? fopen(cachePath, "rb") : NULL;
+    uint8_t headerBytes[HEADER_SIZE];
+    bool current = file != NULL && readHeader(file, &stamp, false, headerBytes);
+    if (file != NULL) fclose(file);
+
+    if (!current) {
+        ObjFunction* function = newFunction(vm, path, 0);
+        Writer body = {NULL, 0, 0};
+
+        if (compile(source, vm, function, false) == INTERPRET_OK && writeFunction(&body, function)) {
+            if (cached) storeCache(cachePath, &stamp, &body, false);
+
+            /* Plain heap memory, it is handed to another vm */ 
+            bytecode = (uint8_t*)malloc(body.count);
+            if (bytecode == NULL) exit(1);
+            memcpy(bytecode, body.bytes, body.count);
+            *bytecodeLength = body.count;
+        }
+
+        FREE_ARRAY(MEMORY_OTHER, uint8_t, body.bytes, body.capacity);
+    }
+
+    if (cachePath != NULL) FREE_ARRAY(MEMORY_OTHER, char, cachePath, strlen(cachePath) + 1);
+    return bytecode;
+}
+
+bool loadBytecode(VM* vm, const uint8_t* bytecode, size_t length, ObjFunction* function) {
+    return readModule(vm, bytecode, length, function);
+}
+
+/* - - - - - - - - Embedded modules - - - - - - - - */
+
+const EmbeddedModule* findEmbeddedModule(const char* path) {
+    for (int i = 0; i < embeddedModuleCount; i++) {
+        if (strcmp(embeddedModules[i].path, path) == 0) return &embeddedModules[i];
+    }
+
+    return NULL;
+}
+
+bool loadEmbeddedModule(VM* vm, const EmbeddedModule* module, ObjFunction* function) {
+    return loadBytecode(vm, module->bytecode, module->length, function);
+}
+
+bool embedModules(VM* vm, const char* outPath, char** paths, int count) {
+    FILE* out = fopen(outPath, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Could not open %s\n", outPath);
+        return false;
+    }
+
+    fprintf(out, "/* Generated by 'mega --embed', the bytecode of the files it was given */\n\n");
+    fprintf(out, "#include \"../includes/bytecache.h\"\n\n");
+
+    bool compiled = true;
+
+    for (int i = 0; i < count && compiled; i++) {
+        FILE* file = fopen(paths[i], "rb");
+        if (file == NULL) {
+            fprintf(stderr, "Could not open %s\n", paths[i]);
+            compiled = false;
+            break;
+        }
+
+        fseek(file, 0, SEEK_END);
+        size_t length = ftell(file);
+        fseek(file, 0, SEEK_SET);
+
+        char* source = ALLOCATE_ARRAY(MEMORY_OTHER, char, length + 1);
+        source[fread(source, 1, length, file)] = '\0';
+        fclose(file);
+
+        ObjFunction* function = newFunction(vm, paths[i], 0);
+        Writer writer = {NULL, 0, 0};
+
+        compiled = compile(source, vm, function, false) == INTERPRET_OK && writeFunction(&writer, function);
+
+        if (compiled) {
+            fprintf(out, "static const uint8_t module%d[] = {", i);
+            for (size_t j = 0; j < writer.count; j++) {
+                fprintf(out, "%s%d,", j % 20 == 0 ? "\n    " : "", writer.bytes[j]);
+            }
+            fprintf(out, "\n};\n\n");
+        } else {
+            fprintf(stderr, "Could not compile %s\n", paths[i]);
+        }
+
+        FREE_ARRAY(MEMORY_OTHER, uint8_t, writer.bytes, writer.capacity);
+        FREE_ARRAY(MEMORY_OTHER, char, source, length + 1);
+    }
+
+    if (compiled) {
+        fprintf(out, "const EmbeddedModule embeddedModules[] = {\n");
+        for (int i = 0; i < count; i++) {
+            fprintf(out, "    {\"%s\", module%d, sizeof(module%d)},\n", paths[i], i, i);
+        }
+        fprintf(out, "    {NULL, NULL, 0}\n};\n\n");
+        fprintf(out, "const int embeddedModuleCount = %d;\n", count);
+    }
+
+    compiled = fclose(out) == 0 && compiled;
+    if (!compiled) remove(outPath);
+    return compiled;
+}
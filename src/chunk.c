@@ -9,6 +9,8 @@ void initChunk(Chunk* chunk) {
     chunk->elem_count = 0;      /* Set default element count as 0 */
     chunk->code = NULL;         /* Set it to point to null */
     chunk->lines = NULL;
+    chunk->lineCount = 0;
+    chunk->lineCapacity = 0;
     initValueArray(&chunk->constants);                     /* Initialise the constant array */
 }
 
@@ -17,18 +19,50 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line) {
                                                               incoming byte */
         int old = chunk->capacity;
         chunk->capacity = GROW_CAPACITY(old);               /* Update capacity */
-        chunk->code = GROW_ARRAY(uint8_t, chunk->code, old, chunk->capacity); /* Grow array preprocessor */  
-        chunk->lines = GROW_ARRAY(int, chunk->lines, old, chunk->capacity);                                
+        chunk->code = GROW_ARRAY(MEMORY_BYTECODE, uint8_t, chunk->code, old, chunk->capacity); /* Grow array preprocessor */  
     }
     
     chunk->code[chunk->elem_count] = byte;                  /* Append Byte */
-    chunk->lines[chunk->elem_count] = line;                 /* Add the line */
+
+    /* Only a change of line starts a new entry, most lines compile to many bytes */
+    if (chunk->lineCount == 0 || chunk->lines[chunk->lineCount - 1].line != line) {
+        if (chunk->lineCapacity < chunk->lineCount + 1) {
+            int old = chunk->lineCapacity;
+            chunk->lineCapacity = GROW_CAPACITY(old);
+            chunk->lines = GROW_ARRAY(MEMORY_BYTECODE, LineStart, chunk->lines, old, chunk->lineCapacity);
+        }
+
+        chunk->lines[chunk->lineCount].offset = chunk->elem_count;
+        chunk->lines[chunk->lineCount].line = line;
+        chunk->lineCount++;
+    }
+
     chunk->elem_count++;                                    /* Increment count */
 }
 
+int getLine(Chunk* chunk, int offset) {
+    /* Binary search for the last entry starting at or before the offset */
+    int low = 0;
+    int high = chunk->lineCount - 1;
+
+    if (high < 0) return 0;
+
+    while (low < high) {
+        int middle = low + (high - low + 1) / 2;
+
+        if (chunk->lines[middle].offset <= offset) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+
+    return chunk->lines[low].line;
+}
+
 void freeChunk(Chunk* chunk) {
-    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);       /* Free the code array */
-    FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    FREE_ARRAY(MEMORY_BYTECODE, uint8_t, chunk->code, chunk->capacity);       /* Free the code array */
+    FREE_ARRAY(MEMORY_BYTECODE, LineStart, chunk->lines, chunk->lineCapacity);
     freeValueArray(&chunk->constants);                      /* Free the constant array we initialised earlier */
     initChunk(chunk);                                       /* Re-Initialize the chunk */
 }
@@ -43,11 +77,10 @@ void writeLongByte(Chunk* chunk, uint16_t byte, int line) {
     writeChunk(chunk, (uint8_t)((byte >> 8) & 0xFF), line); 
 }
 
-void writeLongByteAt(Chunk* chunk, uint16_t byte, unsigned int index, int line) {
+void writeLongByteAt(Chunk* chunk, uint16_t byte, unsigned int index) {
+    /* The patched bytes keep the line of the instruction they belong to */
     chunk->code[index] = (uint8_t)(byte & 0xFF);
-    chunk->lines[index] = line;
     chunk->code[index + 1] = (uint8_t)((byte >> 8) & 0xFF);
-    chunk->lines[index + 1] = line;
 }
 
 int writeConstant(Chunk* chunk, Value value, int line) {  
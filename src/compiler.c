@@ -104,7 +104,7 @@ void writeUintArray(UintArray* array, unsigned int value) {
     if (array->capacity < array->count + 1) {
         int oldCapacity = array->capacity;
         array->capacity = GROW_CAPACITY(oldCapacity);
-        array->array = GROW_ARRAY(unsigned int, array->array, oldCapacity, array->capacity);
+        array->array = GROW_ARRAY(MEMORY_OTHER, unsigned int, array->array, oldCapacity, array->capacity);
     }
 
 
@@ -122,7 +122,7 @@ unsigned int getUintArray(UintArray* array, int index) {
 }
 
 void freeUintArray(UintArray* array) {
-    FREE_ARRAY(unsigned int, array->array, array->capacity);
+    FREE_ARRAY(MEMORY_OTHER, unsigned int, array->array, array->capacity);
     initUintArray(array);
 }
 
@@ -132,6 +132,9 @@ static void errorAt(Parser* parser, Token* token, const char* message) {
     }
     /* Suppress */
     parser->panicMode = true;
+    parser->hadError = true;
+    if (parser->vm->silentErrors) return;
+
     fprintf(stderr, "Error on line %d : ", token->type == TOKEN_EOF ? token->line - 1 : token->line);
 
     if (token->type == TOKEN_EOF) {
@@ -142,7 +145,6 @@ static void errorAt(Parser* parser, Token* token, const char* message) {
     }
 
     fprintf(stderr, ": %s\n", message);
-    parser->hadError = true;
 }
 
 
@@ -226,7 +228,7 @@ static void patch(Parser* parser, unsigned int index) {
         return;
     }
 
-    writeLongByteAt(currentChunk(parser), currentIndex - index + extra, index, parser->previous.line); 
+    writeLongByteAt(currentChunk(parser), currentIndex - index + extra, index); 
 }
 
 static void patchBreak(Parser* parser, unsigned int index, uint8_t localCount) {
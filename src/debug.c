@@ -126,11 +126,13 @@ int longConstantOperandInstruction(const char* insName, Chunk* chunk, int offset
 int dissembleInstruction(Chunk* chunk, int offset) {
     printf("%04d ", offset);
 
-    if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
+    int line = getLine(chunk, offset);
+
+    if (offset > 0 && line == getLine(chunk, offset - 1)) {
         /* If the line number is the same as the previous instuction's, use a pipe to denote it */
         printf("   | ");
     } else {
-        printf("%4d ", chunk->lines[offset]);
+        printf("%4d ", line);
     }
 
     uint8_t instruction = chunk->code[offset];
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include "../includes/finalize.h"
+#include "../includes/memory.h"
+#include "../includes/debug.h"
+
+#ifdef _WIN32
+#include "../includes/win_dlfnc.h"
+#else 
+#include <dlfcn.h>
+#include <unistd.h>
+#endif
+
+void queueFinalizer(VM* vm, Obj* obj) {
+    /* Called by the sweeper, which means nothing here may collect. 
+     * The object itself is freed right after, so the resource is 
+     * copied out of it */ 
+    Finalizer finalizer;
+
+    switch (obj->type) {
+        case OBJ_SOCKET: {
+            ObjSocket* socket = (ObjSocket*)obj;
+            if (socket->closed) return;
+            finalizer.type = FINALIZE_SOCKET;
+            finalizer.as.sockfd = socket->sockfd;
+            break;
+        }
+        case OBJ_SSOCKET: {
+            ObjSSocket* ssocket = (ObjSSocket*)obj;
+            if (ssocket->closed || ssocket->ssocket == NULL) return;
+            finalizer.type = FINALIZE_SSOCKET;
+            finalizer.as.ssocket = ssocket->ssocket;
+            break;
+        }
+        case OBJ_DLL_CONTAINER: {
+            ObjDllContainer* container = (ObjDllContainer*)obj;
+            if (container->closed || container->handle == NULL) return;
+            finalizer.type = FINALIZE_DLL;
+            finalizer.as.handle = container->handle;
+            break;
+        }
+        default: return;
+    }
+
+    if (vm->finalizerCapacity < vm->finalizerCount + 1) {
+        int oldCapacity = vm->finalizerCapacity;
+        vm->finalizerCapacity = GROW_CAPACITY(oldCapacity);
+        vm->finalizers = GROW_ARRAY(MEMORY_COLLECTOR, Finalizer, vm->finalizers, oldCapacity, vm->finalizerCapacity);
+    }
+
+    vm->finalizers[vm->finalizerCount++] = finalizer;
+}
+
+static void finalize(Finalizer* finalizer) {
+    #ifdef DEBUG_LOG_GC
+        printf("Finalizing a %s\n", finalizer->type == FINALIZE_DLL ? "dll handle" : "socket");
+    #endif
+
+    switch (finalizer->type) {
+        case FINALIZE_SOCKET: {
+            close(finalizer->as.sockfd);
+            break;
+        }
+        case FINALIZE_SSOCKET: {
+            SSOCKET* ssocket = finalizer->as.ssocket;
+            BIO_free_all(ssocket->ssl_bio);
+            SSL_CTX_free(ssocket->ssl_ctx);
+            reallocateArray(MEMORY_OTHER, ssocket, sizeof(SSOCKET), 0);
+            break;
+        }
+        case FINALIZE_DLL: {
+            dlclose(finalizer->as.handle);
+            break;
+        }
+    }
+}
+
+void runFinalizers(VM* vm) {
+    /* The queue is taken over first, so a finalizer which ends up 
+     * queueing more (or triggering a collection) can't disturb the loop */ 
+    Finalizer* finalizers = vm->finalizers;
+    int count = vm->finalizerCount;
+    int capacity = vm->finalizerCapacity;
+
+    vm->finalizers = NULL;
+    vm->finalizerCount = 0;
+    vm->finalizerCapacity = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (finalizers[i].type != FINALIZE_DLL) finalize(&finalizers[i]);
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (finalizers[i].type == FINALIZE_DLL) finalize(&finalizers[i]);
+    }
+
+    vm->gcFinalized += count;
+    FREE_ARRAY(MEMORY_COLLECTOR, Finalizer, finalizers, capacity);
+}
@@ -0,0 +1,292 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../includes/gcmark.h"
+#include "../includes/gcollect.h"
+#include "../includes/memory.h"
+
+#ifdef GC_PARALLEL_MARK
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+struct GCWorker {
+    GCMarker* marker;
+    int id;
+    pthread_t thread;
+    pthread_mutex_t lock;           /* Guards the shared stack */
+    Obj** stack;                    /* Shared part of the grey stack, other threads steal from it */
+    int count;
+    int capacity;
+    Obj* local[GC_MARK_BATCH];      /* Private part, only touched by the owner */
+    int localCount;
+};
+
+struct GCMarker {
+    VM* vm;
+    int threadCount;
+    GCWorker* workers;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned long generation;       /* Bumped to start a trace */
+    int finished;                   /* Helper threads done with the current trace */
+    int active;                     /* Threads which still have or look for grey objects */
+    bool quit;
+};
+
+__thread GCWorker* gcCurrentWorker = NULL;
+
+static void flushLocal(GCWorker* worker) {
+    if (worker->localCount == 0) return;
+    pthread_mutex_lock(&worker->lock);
+
+    int count = worker->count + worker->localCount;
+    if (worker->capacity < count) {
+        int capacity = worker->capacity;
+        while (capacity < count) capacity = GROW_CAPACITY(capacity);
+
+        /* Helper threads can't touch the accounting of the vm, these 
+         * stacks are plain heap memory */ 
+        worker->stack = (Obj**)realloc(worker->stack, capacity * sizeof(Obj*));
+        if (worker->stack == NULL) exit(1);
+        worker->capacity = capacity;
+    }
+
+    memcpy(worker->stack + worker->count, worker->local, worker->localCount * sizeof(Obj*));
+    __atomic_store_n(&worker->count, count, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&worker->lock);
+
+    worker->localCount = 0;
+}
+
+void gcWorkerPush(GCWorker* worker, Obj* obj) {
+    if (worker->localCount == GC_MARK_BATCH) flushLocal(worker);
+    worker->local[worker->localCount++] = obj;
+}
+
+static bool takeWork(GCWorker* worker, GCWorker* from, bool half) {
+    /* Moves a batch of grey objects from a shared stack to the
+     * (empty) private part of worker */
+    pthread_mutex_lock(&from->lock);
+
+    int take = half ? (from->count + 1) / 2 : from->count;
+    if (take > GC_MARK_BATCH) take = GC_MARK_BATCH;
+
+    if (take == 0) {
+        pthread_mutex_unlock(&from->lock);
+        return false;
+    }
+
+    memcpy(worker->local, from->stack + from->count - take, take * sizeof(Obj*));
+    __atomic_store_n(&from->count, from->count - take, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&from->lock);
+
+    worker->localCount = take;
+    return true;
+}
+
+static bool findWork(GCWorker* worker) {
+    if (takeWork(worker, worker, false)) return true;
+
+    /* Steal, starting at the next thread so that not everyone
+     * goes after the same victim */
+    GCMarker* marker = worker->marker;
+    for (int i = 1; i < marker->threadCount; i++) {
+        GCWorker* victim = &marker->workers[(worker->id + i) % marker->threadCount];
+
+        if (__atomic_load_n(&victim->count, __ATOMIC_RELAXED) > 0 && takeWork(worker, victim, true)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool anyWork(GCMarker* marker) {
+    for (int i = 0; i < marker->threadCount; i++) {
+        if (__atomic_load_n(&marker->workers[i].count, __ATOMIC_RELAXED) > 0) return true;
+    }
+
+    return false;
+}
+
+static void drain(GCWorker* worker) {
+    GCMarker* marker = worker->marker;
+    gcCurrentWorker = worker;
+
+    for (;;) {
+        while (worker->localCount > 0 || findWork(worker)) {
+            blackenObject(marker->vm, worker->local[--worker->localCount]);
+        }
+
+        /* Out of work. A thread only goes idle with both parts of its stack
+         * empty, so once every thread is idle there is nothing left to trace */
+        __atomic_sub_fetch(&marker->active, 1, __ATOMIC_SEQ_CST);
+
+        for (;;) {
+            if (anyWork(marker)) {
+                __atomic_add_fetch(&marker->active, 1, __ATOMIC_SEQ_CST);
+                if (findWork(worker)) break;
+                __atomic_sub_fetch(&marker->active, 1, __ATOMIC_SEQ_CST);
+            }
+
+            if (__atomic_load_n(&marker->active, __ATOMIC_SEQ_CST) == 0) {
+                gcCurrentWorker = NULL;
+                return;
+            }
+
+            sched_yield();
+        }
+    }
+}
+
+static void* workerMain(void* data) {
+    GCWorker* worker = (GCWorker*)data;
+    GCMarker* marker = worker->marker;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&marker->lock);
+
+    for (;;) {
+        while (marker->generation == seen && !marker->quit) {
+            pthread_cond_wait(&marker->start, &marker->lock);
+        }
+
+        if (marker->quit) break;
+        seen = marker->generation;
+        pthread_mutex_unlock(&marker->lock);
+
+        drain(worker);
+
+        pthread_mutex_lock(&marker->lock);
+        if (++marker->finished == marker->threadCount - 1) {
+            pthread_cond_signal(&marker->done);
+        }
+    }
+
+    pthread_mutex_unlock(&marker->lock);
+    return NULL;
+}
+
+static GCMarker* newMarker(VM* vm, int threadCount) {
+    GCMarker* marker = (GCMarker*)malloc(sizeof(GCMarker));
+    if (marker == NULL) exit(1);
+
+    marker->vm = vm;
+    marker->workers = (GCWorker*)calloc(threadCount, sizeof(GCWorker));
+    if (marker->workers == NULL) exit(1);
+
+    pthread_mutex_init(&marker->lock, NULL);
+    pthread_cond_init(&marker->start, NULL);
+    pthread_cond_init(&marker->done, NULL);
+    marker->generation = 0;
+    marker->finished = 0;
+    marker->active = 0;
+    marker->quit = false;
+
+    for (int i = 0; i < threadCount; i++) {
+        marker->workers[i].marker = marker;
+        marker->workers[i].id = i;
+        pthread_mutex_init(&marker->workers[i].lock, NULL);
+    }
+
+    /* The first worker is the interpreter's thread, if starting
+     * a helper fails we make do with the ones we have */
+    marker->threadCount = 1;
+    for (int i = 1; i < threadCount; i++) {
+        if (pthread_create(&marker->workers[i].thread, NULL, workerMain, &marker->workers[i]) != 0) break;
+        marker->threadCount++;
+    }
+
+    return marker;
+}
+
+bool gcParallelTrace(VM* vm) {
+    if (vm->gcMarkThreads <= 1) return false;
+    if (vm->marker == NULL) vm->marker = newMarker(vm, vm->gcMarkThreads);
+
+    GCMarker* marker = vm->marker;
+
+    /* Hand out the grey objects found so far, the helpers are
+     * waiting so their stacks can be filled without a race */
+    for (int i = 0; i < vm->greyCount; i++) {
+        gcWorkerPush(&marker->workers[i % marker->threadCount], vm->greyStack[i]);
+    }
+
+    for (int i = 0; i < marker->threadCount; i++) {
+        flushLocal(&marker->workers[i]);
+    }
+
+    vm->greyCount = 0;
+
+    pthread_mutex_lock(&marker->lock);
+    marker->generation++;
+    marker->finished = 0;
+    marker->active = marker->threadCount;
+    pthread_cond_broadcast(&marker->start);
+    pthread_mutex_unlock(&marker->lock);
+
+    drain(&marker->workers[0]);
+
+    pthread_mutex_lock(&marker->lock);
+    while (marker->finished < marker->threadCount - 1) {
+        pthread_cond_wait(&marker->done, &marker->lock);
+    }
+    pthread_mutex_unlock(&marker->lock);
+
+    return true;
+}
+
+void freeMarker(VM* vm) {
+    GCMarker* marker = vm->marker;
+    if (marker == NULL) return;
+
+    pthread_mutex_lock(&marker->lock);
+    marker->quit = true;
+    pthread_cond_broadcast(&marker->start);
+    pthread_mutex_unlock(&marker->lock);
+
+    for (int i = 0; i < marker->threadCount; i++) {
+        GCWorker* worker = &marker->workers[i];
+
+        if (i > 0) pthread_join(worker->thread, NULL);
+        pthread_mutex_destroy(&worker->lock);
+        free(worker->stack);
+    }
+
+    pthread_mutex_destroy(&marker->lock);
+    pthread_cond_destroy(&marker->start);
+    pthread_cond_destroy(&marker->done);
+    free(marker->workers);
+    free(marker);
+    vm->marker = NULL;
+}
+
+static int countCores() {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (int)cores : 1;
+}
+
+#else
+
+bool gcParallelTrace(VM* vm) {
+    return false;
+}
+
+void freeMarker(VM* vm) {
+}
+
+static int countCores() {
+    return 1;
+}
+
+#endif
+
+void gcSetMarkThreads(VM* vm, int threads) {
+    if (threads <= 0) threads = countCores();
+    if (threads > GC_MAX_MARK_THREADS) threads = GC_MAX_MARK_THREADS;
+
+    /* The helpers are started again with the new count by the next trace */
+    if (threads != vm->gcMarkThreads) freeMarker(vm);
+    vm->gcMarkThreads = threads;
+}
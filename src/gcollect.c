@@ -1,16 +1,85 @@
 #include "../includes/gcollect.h"
+#include "../includes/gcmark.h"
 #include "../includes/debug.h"
 #include "../includes/memory.h"
+#include "../includes/finalize.h"
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
 
-void collectGarbage(VM* vm) {
-    /* We dont run our gc during compilation time */ 
-    if (!vm->running) return;
-    #ifdef DEBUG_LOG_MEMORY
-        printf("=== GC BEGIN ===\n");
-    #endif
+static void finishTrace(VM* vm);
+
+static size_t clampThreshold(VM* vm, size_t threshold) {
+    /* Nothing is collected below the minimum heap size, and the maximum 
+     * size is never allowed to pass without a collection */ 
+    if (threshold < vm->gcMinHeap) threshold = vm->gcMinHeap;
+    if (vm->gcMaxHeap > 0 && threshold > vm->gcMaxHeap) threshold = vm->gcMaxHeap;
+    return threshold;
+}
+
+static void checkHeapLimit(VM* vm) {
+    /* Runs after a full collection, if even that didn't get the 
+     * heap under its limit there is no way to go on */ 
+    if (vm->gcMaxHeap > 0 && vm->bytesAllocated >= vm->gcMaxHeap) {
+        fprintf(stderr, "Out of memory, %zu bytes are still in use with a heap limit of %zu bytes\n", 
+                vm->bytesAllocated, vm->gcMaxHeap);
+        exit(1);
+    }
+}
+
+static void markRemembered(VM* vm) {
+    /* Old objects which were written young references since the last 
+     * collection act as extra roots for a minor collection */ 
+    for (int i = 0; i < vm->rememberedCount; i++) {
+        blackenObject(vm, vm->remembered[i]);
+    }
+}
+
+static void clearRemembered(VM* vm) {
+    for (int i = 0; i < vm->rememberedCount; i++) {
+        vm->remembered[i]->isRemembered = false;
+    }
+
+    vm->rememberedCount = 0;
+}
+
+void gcRemember(VM* vm, Obj* obj) {
+    if (vm->rememberedCapacity < vm->rememberedCount + 1) {
+        int oldCapacity = vm->rememberedCapacity;
+        vm->rememberedCapacity = GROW_CAPACITY(oldCapacity);
+        vm->remembered = GROW_ARRAY(MEMORY_COLLECTOR, Obj*, vm->remembered, oldCapacity, vm->rememberedCapacity);
+    }
+
+    obj->isRemembered = true;
+    vm->remembered[vm->rememberedCount++] = obj;
+}
+
+static void promoteSurvivors(VM* vm) {
+    /* Every marked object is now part of the old generation (a minor collection 
+     * keeps the old objects), which makes everything else on the page garbage. 
+     * Only pages with garbage on them have to be swept */ 
+    for (PoolPage* page = vm->objects.pages; page != NULL; page = page->nextPage) {
+        bool garbage = false;
+
+        for (int word = 0; word < POOL_BITMAP_WORDS; word++) {
+            uint64_t live = page->marked[word];
+            if (vm->minorGC) live |= page->old[word];
+
+            page->old[word] = live;
+            page->marked[word] = 0;
+            if (page->allocated[word] & ~live) garbage = true;
+        }
+
+        page->unswept = garbage;
+    }
+}
 
-    #if defined(DEBUG_LOG_GC) || defined(DEBUG_LOG_MEMORY)
-        size_t before = vm->bytesAllocated;
+static void generationalCollection(VM* vm) {
+    #ifdef DEBUG_LOG_MEMORY
+        printf("=== GC BEGIN (%s) ===\n", vm->minorGC ? "minor" : "full");
     #endif
     
     /* Marking phase 
@@ -20,6 +89,7 @@ void collectGarbage(VM* vm) {
      * We mark the particular heap allocated value of type obj if we find it to be 
      * reachable */ 
     markRoots(vm);
+    if (vm->minorGC) markRemembered(vm);
 
     /* Tracing phase 
      *
@@ -27,24 +97,338 @@ void collectGarbage(VM* vm) {
      * a grey list, which gets re visited to "blacken" the inner objects to mark 
      * them as reachable too */ 
     traceObjects(vm);
-    
-    /* Remove weak references from string intern table */ 
-    clearTableWeakref(vm, &vm->strings);
+    finishTrace(vm);
+
+    /* Every survivor is now part of the old generation, so the remembered set 
+     * is emptied, and the sweep starts. It runs lazily from now on, a full 
+     * collection may free remembered objects */ 
+    clearRemembered(vm);
+    promoteSurvivors(vm);
+    vm->sweepPage = vm->objects.pages;
+    vm->gcPhase = GC_PHASE_SWEEP;
+
+    /* The heap only shrinks until the sweep is over, which schedules 
+     * the next collection properly */ 
+    size_t nursery = vm->bytesAllocated / GC_NURSERY_RATIO;
+    if (nursery < GC_NURSERY_SIZE) nursery = GC_NURSERY_SIZE;
+    vm->nextGC = clampThreshold(vm, vm->bytesAllocated + nursery);
 
-    /* Sweep phase 
-     *
-     * We iterate over all the objects, free the unmarked ones, and reset the mark */ 
-    sweep(vm);
-    vm->nextGC = vm->bytesAllocated * 2; 
     #if defined(DEBUG_LOG_MEMORY) || defined(DEBUG_LOG_GC)
-        printf("Collected %zu bytes (from %zu to %zu) next at %zu\n", 
-                before - vm->bytesAllocated, before, vm->bytesAllocated, 
-                vm->nextGC);
+        printf("Marked a %s collection at %zu bytes\n", 
+                vm->minorGC ? "minor" : "full", vm->bytesAllocated);
     #endif 
+
     #ifdef DEBUG_LOG_MEMORY
         printf("=== GC END ===\n");
     #endif
 }
+
+static void finishSweep(VM* vm) {
+    poolTrim(&vm->objects);
+    poolTrim(&vm->blocks);
+    vm->gcPhase = GC_PHASE_PAUSE;
+
+    vm->gcCollections++;
+
+    /* Schedule the next collection, which is a full one only if the old generation 
+     * has outgrown its threshold */ 
+    if (!vm->minorGC) {
+        checkHeapLimit(vm);
+        vm->gcFullCollections++;
+        vm->nextFullGC = clampThreshold(vm, (size_t)(vm->bytesAllocated * vm->gcGrowFactor));
+    }
+
+    size_t nursery = vm->bytesAllocated / GC_NURSERY_RATIO;
+    if (nursery < GC_NURSERY_SIZE) nursery = GC_NURSERY_SIZE;
+
+    #if defined(DEBUG_LOG_MEMORY) || defined(DEBUG_LOG_GC)
+        printf("Swept a %s collection down to %zu bytes\n", 
+                vm->minorGC ? "minor" : "full", vm->bytesAllocated);
+    #endif 
+
+    vm->nextGC = clampThreshold(vm, vm->bytesAllocated + nursery);
+
+    /* A heap at its limit only has a full collection left to try */ 
+    vm->minorGC = vm->bytesAllocated < vm->nextFullGC && vm->bytesAllocated < vm->nextGC;
+}
+
+void gcSweepStep(VM* vm) {
+    /* Sweeps the next page which still needs it, pages 
+     * the allocator already swept are skipped */ 
+    while (vm->sweepPage != NULL) {
+        PoolPage* page = vm->sweepPage;
+        vm->sweepPage = page->nextPage;
+
+        if (page->unswept) {
+            gcSweepPage(vm, page);
+            return;
+        }
+    }
+
+    finishSweep(vm);
+}
+
+void sweep(VM* vm) {
+    while (vm->gcPhase == GC_PHASE_SWEEP) {
+        gcSweepStep(vm);
+    }
+}
+
+/* Incremental collection 
+ *
+ * A cycle is split into slices which run every vm->gcStepSize allocated bytes, 
+ * each slice does at most vm->gcStepUnits units of work (objects blackened or 
+ * swept) and stops early once vm->gcStepMicros microseconds have passed if set. 
+ *
+ * Marking keeps the tri-color invariant (no black object points to a white one) 
+ * through the write barriers. Objects allocated while marking start out white, 
+ * so marking always catches up with the allocator, they are reached through 
+ * a barrier or through the roots. The roots aren't guarded by barriers, so they 
+ * are marked again in a final atomic slice before the weak references are cleared */ 
+
+static bool sliceOver(VM* vm, int work, int units, clock_t start) {
+    if (work >= units) return true;
+
+    /* Checking the clock is not free, so it is only done every few units */ 
+    if (vm->gcStepMicros > 0 && (work & 63) == 0) {
+        double elapsed = (double)(clock() - start) * 1000000.0 / CLOCKS_PER_SEC;
+        return elapsed >= vm->gcStepMicros;
+    }
+
+    return false;
+}
+
+static void finishMark(VM* vm) {
+    /* Atomic part, the stack and other roots might have changed since 
+     * the cycle started */ 
+    markRoots(vm);
+    traceObjects(vm);
+    finishTrace(vm);
+
+    /* Every page which exists now is swept, the allocator sweeps 
+     * a page itself before allocating from it */ 
+    for (PoolPage* page = vm->objects.pages; page != NULL; page = page->nextPage) {
+        page->unswept = true;
+    }
+
+    vm->sweepPage = vm->objects.pages;
+    vm->gcPhase = GC_PHASE_SWEEP;
+}
+
+static bool sweepSlice(VM* vm, int* work, int units, clock_t start) {
+    /* Returns true once every object has been swept */ 
+    while (vm->sweepPage != NULL) {
+        if (sliceOver(vm, *work, units, start)) return false;
+
+        /* Pages mapped during the sweep come before the cursor, and emptied 
+         * pages stay mapped until the trim, so the cursor stays valid */ 
+        PoolPage* page = vm->sweepPage;
+        vm->sweepPage = page->nextPage;
+        if (!page->unswept) continue;
+
+        *work += page->used;
+        gcSweepPage(vm, page);
+    }
+
+    poolTrim(&vm->objects);
+    poolTrim(&vm->blocks);
+    return true;
+}
+
+static void incrementalStep(VM* vm, int units) {
+    clock_t start = clock();
+    int work = 0;
+
+    switch (vm->gcPhase) {
+        case GC_PHASE_PAUSE:
+            #if defined(DEBUG_LOG_MEMORY) || defined(DEBUG_LOG_GC)
+                printf("Incremental cycle started at %zu bytes\n", vm->bytesAllocated);
+            #endif
+            markRoots(vm);
+            vm->gcPhase = GC_PHASE_MARK;
+            break;
+        case GC_PHASE_MARK:
+            while (vm->greyCount > 0 && !sliceOver(vm, work, units, start)) {
+                blackenObject(vm, vm->greyStack[--vm->greyCount]);
+                work++;
+            }
+
+            if (vm->greyCount == 0) finishMark(vm);
+            break;
+        case GC_PHASE_SWEEP:
+            if (sweepSlice(vm, &work, units, start)) {
+                vm->gcPhase = GC_PHASE_PAUSE;
+                vm->gcCollections++;
+                vm->gcFullCollections++;
+            }
+            break;
+    }
+
+    if (vm->gcPhase == GC_PHASE_PAUSE) {
+        vm->nextGC = clampThreshold(vm, (size_t)(vm->bytesAllocated * vm->gcGrowFactor));
+
+        #if defined(DEBUG_LOG_MEMORY) || defined(DEBUG_LOG_GC)
+            printf("Incremental cycle finished at %zu bytes, next at %zu\n", 
+                    vm->bytesAllocated, vm->nextGC);
+        #endif
+    } else {
+        vm->nextGC = vm->bytesAllocated + vm->gcStepSize;
+    }
+}
+
+void collectGarbage(VM* vm) {
+    /* We dont run our gc during compilation time, or while a script stopped it */ 
+    if (!vm->running || !vm->gcEnabled) return;
+
+    if (vm->gcMode == GC_MODE_INCREMENTAL) {
+        /* A heap at its limit can't wait for the slices to catch up, 
+         * and only a cycle run in one go tells what's really alive */ 
+        if (vm->gcMaxHeap > 0 && vm->bytesAllocated >= vm->gcMaxHeap) {
+            gcCollect(vm);
+            checkHeapLimit(vm);
+        } else {
+            incrementalStep(vm, vm->gcStepUnits);
+        }
+    } else {
+        /* The garbage of the last collection has to be gone 
+         * before marking again */ 
+        sweep(vm);
+        generationalCollection(vm);
+    }
+}
+
+static void finishCycle(VM* vm) {
+    if (vm->gcMode == GC_MODE_INCREMENTAL) {
+        while (vm->gcPhase != GC_PHASE_PAUSE) incrementalStep(vm, INT_MAX);
+    } else {
+        sweep(vm);
+    }
+}
+
+void gcCollect(VM* vm) {
+    /* A cycle which is already running may have marked objects which died 
+     * since, so it is finished first and then a whole new one is run */ 
+    finishCycle(vm);
+
+    if (vm->gcMode == GC_MODE_INCREMENTAL) {
+        do {
+            incrementalStep(vm, INT_MAX);
+        } while (vm->gcPhase != GC_PHASE_PAUSE);
+    } else {
+        vm->minorGC = false;
+        generationalCollection(vm);
+        sweep(vm);
+    }
+
+    gcFinalize(vm);
+}
+
+bool gcStep(VM* vm, int units) {
+    /* Does about units of work, returns true if that finished a cycle. 
+     * The generational collector marks in one go, its units are pages swept */ 
+    if (vm->gcMode == GC_MODE_INCREMENTAL) {
+        incrementalStep(vm, units);
+    } else if (vm->gcPhase == GC_PHASE_PAUSE) {
+        generationalCollection(vm);
+        return false;
+    } else {
+        for (int i = 0; i < units && vm->gcPhase == GC_PHASE_SWEEP; i++) {
+            gcSweepStep(vm);
+        }
+    }
+
+    gcFinalize(vm);
+    return vm->gcPhase == GC_PHASE_PAUSE;
+}
+
+static bool parseSize(const char* value, size_t* size) {
+    /* A number of bytes, optionally followed by K, M or G */ 
+    char* end;
+    double number = strtod(value, &end);
+    if (end == value || number < 0) return false;
+
+    switch (toupper((unsigned char)*end)) {
+        case 'K': number *= 1024; end++; break;
+        case 'M': number *= 1024 * 1024; end++; break;
+        case 'G': number *= 1024.0 * 1024 * 1024; end++; break;
+        default: break;
+    }
+
+    if (toupper((unsigned char)*end) == 'B') end++;
+    if (*end != '\0') return false;
+
+    *size = (size_t)number;
+    return true;
+}
+
+static void setMode(VM* vm, GCMode mode) {
+    if (mode == vm->gcMode) return;
+    finishCycle(vm);
+
+    /* Incremental cycles don't know about generations, so every object is 
+     * made young again, and the next generational collection is a full one */ 
+    for (PoolPage* page = vm->objects.pages; page != NULL; page = page->nextPage) {
+        memset(page->old, 0, sizeof(page->old));
+    }
+
+    clearRemembered(vm);
+    vm->minorGC = false;
+    vm->gcMode = mode;
+}
+
+bool gcSetOption(VM* vm, const char* name, const char* value) {
+    if (strcmp(name, "growth") == 0) {
+        char* end;
+        double factor = strtod(value, &end);
+        if (end == value || *end != '\0' || factor < 1) return false;
+
+        vm->gcGrowFactor = factor;
+    } else if (strcmp(name, "min-heap") == 0) {
+        if (!parseSize(value, &vm->gcMinHeap)) return false;
+    } else if (strcmp(name, "max-heap") == 0) {
+        if (!parseSize(value, &vm->gcMaxHeap)) return false;
+    } else if (strcmp(name, "mode") == 0) {
+        if (strcmp(value, "generational") == 0) {
+            setMode(vm, GC_MODE_GENERATIONAL);
+        } else if (strcmp(value, "incremental") == 0) {
+            setMode(vm, GC_MODE_INCREMENTAL);
+        } else {
+            return false;
+        }
+    } else if (strcmp(name, "threads") == 0) {
+        char* end;
+        long threads = strtol(value, &end, 10);
+        if (end == value || *end != '\0' || threads < 0) return false;
+
+        gcSetMarkThreads(vm, (int)threads);
+    } else {
+        return false;
+    }
+
+    /* The thresholds follow the new limits right away */ 
+    vm->nextGC = clampThreshold(vm, vm->nextGC);
+    vm->nextFullGC = clampThreshold(vm, vm->nextFullGC);
+    return true;
+}
+
+void gcReadEnvironment(VM* vm) {
+    static const char* options[][2] = {
+        { "MEGA_GC_GROWTH", "growth" },
+        { "MEGA_GC_MIN_HEAP", "min-heap" },
+        { "MEGA_GC_MAX_HEAP", "max-heap" },
+        { "MEGA_GC_MODE", "mode" },
+        { "MEGA_GC_THREADS", "threads" },
+    };
+
+    for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+        char* value = getenv(options[i][0]);
+
+        if (value != NULL && !gcSetOption(vm, options[i][1], value)) {
+            fprintf(stderr, "Ignoring invalid value '%s' of %s\n", value, options[i][0]);
+        }
+    }
+}
+
 void markObject(VM* vm, Obj* obj) {
     /* 
      * In some cases, it might not be an object at all, so we 
@@ -52,10 +436,33 @@ void markObject(VM* vm, Obj* obj) {
     if (obj == NULL) {
         return;
     }
-    if (obj->isMarked) {
+    PoolPage* page = poolPageOf(obj);
+    int index = poolIndexOf(page, obj);
+
+    /* Old objects are assumed to be alive during a minor collection */ 
+    if (vm->minorGC && POOL_TEST_BIT(page->old, index)) {
+        return;
+    }
+
+    #ifdef GC_PARALLEL_MARK
+        if (gcCurrentWorker != NULL) {
+            /* Other threads may be marking objects of the same word, a plain 
+             * load first skips the locked instruction for marked objects */ 
+            uint64_t* word = &page->marked[index >> 6];
+            uint64_t bit = (uint64_t)1 << (index & 63);
+
+            if (__atomic_load_n(word, __ATOMIC_RELAXED) & bit) return;
+            if (__atomic_fetch_or(word, bit, __ATOMIC_RELAXED) & bit) return;
+
+            gcWorkerPush(gcCurrentWorker, obj);
+            return;
+        }
+    #endif
+
+    if (POOL_TEST_BIT(page->marked, index)) {
         return;
     }
-    obj->isMarked = true;
+    POOL_SET_BIT(page->marked, index);
     
     #ifdef DEBUG_LOG_MEMORY
         printf("%p marked ", (void*)obj);
@@ -65,7 +472,7 @@ void markObject(VM* vm, Obj* obj) {
     
     if (vm->greyCapacity < vm->greyCount + 1) {
         vm->greyCapacity = GROW_CAPACITY(vm->greyCapacity);
-        vm->greyStack = reallocateArray(vm->greyStack, vm->greyCount * sizeof(Obj*), vm->greyCapacity * sizeof(Obj*));
+        vm->greyStack = reallocateArray(MEMORY_COLLECTOR, vm->greyStack, vm->greyCount * sizeof(Obj*), vm->greyCapacity * sizeof(Obj*));
     }
 
     vm->greyStack[vm->greyCount++] = obj;
@@ -79,14 +486,155 @@ void markValue(VM* vm, Value value) {
 
 void markTable(VM* vm, Table* table) {
     /* We iterate through the hash table and mark the key as well as its actual value */ 
-    for (int i = 0; i < table->capacity; i++) {
+    for (int i = 0; i < table->entryCount; i++) {
         Entry* entry = &table->entries[i];
 
-        if (entry->key != NULL) {
-            markObject(vm, &entry->key->obj);
+        if (!CHECK_NIL(entry->key)) {
+            markValue(vm, entry->key);
             markValue(vm, entry->value);
         }
     }
+
+    /* The array part only holds values, its keys are numbers */
+    for (int i = 0; i < table->array.count; i++) {
+        markValue(vm, table->array.values[i]);
+    }
+}
+
+static bool isWeak(Value value) {
+    return CHECK_OBJ(value) && AS_OBJ(value)->type != OBJ_STRING;
+}
+
+static bool isAlive(VM* vm, Value value) {
+    /* Only meaningful once tracing is over, a minor collection 
+     * leaves the old generation unmarked */ 
+    if (!isWeak(value)) return true;
+    Obj* obj = AS_OBJ(value);
+    return gcIsMarked(obj) || (vm->minorGC && gcIsOld(obj));
+}
+
+static void listWeakTable(VM* vm, ObjTable* table) {
+    /* A table can be blackened more than once (by a barrier), but 
+     * is only listed once. Parallel markers push with a CAS */ 
+    #ifdef GC_PARALLEL_MARK
+        if (gcCurrentWorker != NULL) {
+            if (__atomic_exchange_n(&table->weakListed, true, __ATOMIC_RELAXED)) return;
+
+            ObjTable* head = __atomic_load_n(&vm->weakTables, __ATOMIC_RELAXED);
+            do {
+                table->nextWeak = head;
+            } while (!__atomic_compare_exchange_n(&vm->weakTables, &head, table, true, 
+                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+            return;
+        }
+    #endif
+
+    if (table->weakListed) return;
+    table->weakListed = true;
+    table->nextWeak = vm->weakTables;
+    vm->weakTables = table;
+}
+
+void markWeakTable(VM* vm, ObjTable* table) {
+    /* Only the strong half of every entry is marked, the weak half 
+     * is cleared by clearWeakTables once tracing is done. Ephemeron 
+     * values whose key isn't known to be alive yet are left for 
+     * traceEphemerons */ 
+    listWeakTable(vm, table);
+    Table* entries = &table->table;
+
+    for (int i = 0; i < entries->entryCount; i++) {
+        Entry* entry = &entries->entries[i];
+        if (CHECK_NIL(entry->key)) continue;
+
+        switch (table->mode) {
+            case TABLE_WEAK_KEYS:
+                if (!isWeak(entry->key)) markValue(vm, entry->key);
+                markValue(vm, entry->value);
+                break;
+            case TABLE_WEAK_VALUES:
+                markValue(vm, entry->key);
+                if (!isWeak(entry->value)) markValue(vm, entry->value);
+                break;
+            case TABLE_EPHEMERON:
+                if (!isWeak(entry->key)) {
+                    markValue(vm, entry->key);
+                    markValue(vm, entry->value);
+                }
+                break;
+            default: break;
+        }
+    }
+
+    /* The keys of the array part are numbers, which are never weak */ 
+    if (table->mode != TABLE_WEAK_VALUES) {
+        markArray(vm, &entries->array);
+    } else {
+        for (int i = 0; i < entries->array.count; i++) {
+            if (!isWeak(entries->array.values[i])) markValue(vm, entries->array.values[i]);
+        }
+    }
+}
+
+static void traceEphemerons(VM* vm) {
+    /* The value of an ephemeron entry is alive once its key is, which 
+     * can make more keys alive, so this runs until nothing new is marked */ 
+    for (;;) {
+        for (ObjTable* table = vm->weakTables; table != NULL; table = table->nextWeak) {
+            if (table->mode != TABLE_EPHEMERON) continue;
+
+            for (int i = 0; i < table->table.entryCount; i++) {
+                Entry* entry = &table->table.entries[i];
+
+                if (!CHECK_NIL(entry->key) && isAlive(vm, entry->key)) {
+                    markValue(vm, entry->value);
+                }
+            }
+        }
+
+        if (vm->greyCount == 0) return;
+        traceObjects(vm);
+    }
+}
+
+static void clearWeakTables(VM* vm) {
+    for (ObjTable* table = vm->weakTables; table != NULL; table = table->nextWeak) {
+        Table* entries = &table->table;
+        bool weakValues = table->mode == TABLE_WEAK_VALUES;
+
+        for (int i = 0; i < entries->entryCount; i++) {
+            Entry* entry = &entries->entries[i];
+            if (CHECK_NIL(entry->key)) continue;
+
+            if (weakValues ? !isAlive(vm, entry->value) : !isAlive(vm, entry->key)) {
+                deleteValueTable(entries, entry->key);
+            }
+        }
+
+        if (weakValues) {
+            for (int i = 0; i < entries->array.count; i++) {
+                if (!isAlive(vm, entries->array.values[i])) entries->array.values[i] = NIL();
+            }
+        }
+
+        compactTable(entries);
+        table->weakListed = false;
+    }
+
+    vm->weakTables = NULL;
+}
+
+static void finishTrace(VM* vm) {
+    /* Everything reachable is marked at this point, except for what 
+     * only ephemerons keep alive. Dead weak references are dropped 
+     * before the sweep frees what they point to */ 
+    traceEphemerons(vm);
+    clearWeakTables(vm);
+
+    /* Remove weak references from string intern table, and reclaim 
+     * the slots of the strings which died */ 
+    clearTableWeakref(vm, &vm->strings);
+    compactTable(&vm->strings);
 }
 
 void markPtrTable(VM* vm, PtrTable* table) {
@@ -119,6 +667,7 @@ void markRoots(VM* vm) {
     markPtrTable(vm, &vm->dllMethods);
 
     markTable(vm, &vm->importCache); 
+    markTable(vm, &vm->resolvedImports);
 
     /* Mark the running functions in the call stack */ 
     for (int i = 0; i < vm->frameCount; i++) {
@@ -135,8 +684,9 @@ void markRoots(VM* vm) {
     for (int i = 0; i < vm->moduleCount; i++) {
         Module mod = vm->modules[i];
         
-        markObject(vm, &vm->globals->obj);
+        markObject(vm, &mod.globals->obj);
         markObject(vm, &mod.moduleName->obj);
+        markObject(vm, &mod.modulePath->obj);
     }
 }
 
@@ -166,6 +716,11 @@ void blackenObject(VM* vm, Obj* obj) {
             }
             break;
         }
+        case OBJ_UPVALUE:
+            /* Open upvalues point into the stack which is already a root, 
+             * closed ones own their value */ 
+            markValue(vm, ((ObjUpvalue*)obj)->closed);
+            break;
         case OBJ_ARRAY:
             markArray(vm, &(((ObjArray*)obj)->array));
             break;
@@ -199,7 +754,12 @@ void blackenObject(VM* vm, Obj* obj) {
         }
         case OBJ_TABLE: {
             ObjTable* table = (ObjTable*)obj;
-            markTable(vm, &table->table);
+
+            if (table->mode == TABLE_STRONG) {
+                markTable(vm, &table->table);
+            } else {
+                markWeakTable(vm, table);
+            }
             break;
         }
         case OBJ_NATIVE_METHOD: {
@@ -209,7 +769,9 @@ void blackenObject(VM* vm, Obj* obj) {
             break;
         }
         case OBJ_DLL_CONTAINER: {
-            markObject(vm, &((ObjDllContainer*)obj)->fileName->obj);
+            ObjDllContainer* container = (ObjDllContainer*)obj;
+            markObject(vm, &container->fileName->obj);
+            if (container->natives != NULL) markObject(vm, &container->natives->obj);
             break;
         }
         case OBJ_COROUTINE: {
@@ -248,6 +810,8 @@ void blackenObject(VM* vm, Obj* obj) {
 }
 
 void traceObjects(VM* vm) {
+    if (gcParallelTrace(vm)) return;
+
     while (vm->greyCount > 0) {
         Obj* object = vm->greyStack[--vm->greyCount];
         blackenObject(vm, object);
@@ -255,34 +819,36 @@ void traceObjects(VM* vm) {
 }
 
 void clearTableWeakref(VM* vm, Table* table) {
-    for (int i = 0; i < table->capacity; i++) {
+    for (int i = 0; i < table->entryCount; i++) {
         Entry* entry = &table->entries[i];
     
-        if (entry->key != NULL && !entry->key->obj.isMarked) {
-            deleteTable(table, entry->key);
+        if (!CHECK_OBJ(entry->key)) continue;
+        Obj* key = AS_OBJ(entry->key);
+
+        /* A minor collection leaves the old generation unmarked */ 
+        if (!gcIsMarked(key) && !(vm->minorGC && gcIsOld(key))) {
+            deleteValueTable(table, entry->key);
         }
     }
 }
 
-void sweep(VM* vm) {
-    Obj* object = vm->ObjHead;
-    Obj* prev = NULL;
-
-    while (object != NULL) {
-        if (object->isMarked) {
-            object->isMarked = false;
-            prev = object;
-            object = object->next;
-        } else {
-            Obj* garbage = object;
-            object = object->next;
-            if (prev == NULL) {
-                vm->ObjHead = object;
-            } else {
-                prev->next = object;
-            }
+void gcSweepPage(void* data, PoolPage* page) {
+    /* Only the bitmaps are read to find the garbage, live objects are 
+     * never touched. The generational collector has already promoted 
+     * the survivors when marking finished */ 
+    VM* vm = (VM*)data;
+    uint64_t* live = vm->gcMode == GC_MODE_GENERATIONAL ? page->old : page->marked;
+
+    for (int word = 0; word < POOL_BITMAP_WORDS; word++) {
+        uint64_t garbage = page->allocated[word] & ~live[word];
+        page->marked[word] = 0;
 
-            freeObject(vm, garbage);
+        while (garbage != 0) {
+            int bit = countTrailingZeros(garbage);
+            garbage &= garbage - 1;
+            freeObject(vm, (Obj*)poolBlockAt(page, word * 64 + bit));
         }
     }
+
+    page->unswept = false;
 }
@@ -2,34 +2,33 @@
 #include "../includes/object.h"
 #include "../includes/value.h"
 #include "../includes/msapi.h"
+#include "../includes/gcollect.h"
+#include <stdio.h>
 #include <time.h>
 #include <stdlib.h>
 #include <string.h>
 
+static void defineNative(VM* vm, const char* name, NativeFuncPtr function) {
+    /* Both objects are kept on the stack until they are stored, since 
+     * this can run while the collector is active (importing a module) */
+    msapi_push(vm, OBJ(allocateString(vm, name, strlen(name))));
+    msapi_push(vm, OBJ(allocateNativeFunction(vm, AS_STRING(msapi_peek(vm, 0)), function)));
+
+    insertTable(&vm->globals->table, AS_STRING(msapi_peek(vm, 1)), msapi_peek(vm, 0));
+    gcWriteBarrierEntry(vm, &vm->globals->obj, msapi_peek(vm, 1), msapi_peek(vm, 0));
+    msapi_popn(vm, 2);
+}
+
 void injectGlobals(VM* vm) {
-    ObjString* str_print = allocateString(vm, "print", 5);
-    ObjString* str_str = allocateString(vm, "str", 3);
-    ObjString* str_num = allocateString(vm, "num", 3);
-    ObjString* str_clock = allocateString(vm, "clock", 5);
-    ObjString* str_type = allocateString(vm, "type", 4);
-    ObjString* str_input = allocateString(vm, "input", 5);
-    ObjString* str_char = allocateString(vm, "char", 4);
-
-    ObjNativeFunction* native_print = allocateNativeFunction(vm, str_print, &msglobal_print);
-    ObjNativeFunction* native_clock = allocateNativeFunction(vm, str_clock, &msglobal_clock);
-    ObjNativeFunction* native_str = allocateNativeFunction(vm, str_str, &msglobal_str);
-    ObjNativeFunction* native_num = allocateNativeFunction(vm, str_num, &msglobal_num);
-    ObjNativeFunction* native_type = allocateNativeFunction(vm, str_type, &msglobal_type);
-    ObjNativeFunction* native_input = allocateNativeFunction(vm, str_input, &msglobal_input);
-    ObjNativeFunction* native_char = allocateNativeFunction(vm, str_char, &msglobal_char);
-
-    insertTable(&vm->globals->table, str_clock, OBJ(native_clock));
-    insertTable(&vm->globals->table, str_str, OBJ(native_str));
-    insertTable(&vm->globals->table, str_num, OBJ(native_num));
-    insertTable(&vm->globals->table, str_type, OBJ(native_type));
-    insertTable(&vm->globals->table, str_print, OBJ(native_print));
-    insertTable(&vm->globals->table, str_input, OBJ(native_input));
-    insertTable(&vm->globals->table, str_char, OBJ(native_char));
+    defineNative(vm, "clock", &msglobal_clock);
+    defineNative(vm, "str", &msglobal_str);
+    defineNative(vm, "num", &msglobal_num);
+    defineNative(vm, "type", &msglobal_type);
+    defineNative(vm, "print", &msglobal_print);
+    defineNative(vm, "input", &msglobal_input);
+    defineNative(vm, "char", &msglobal_char);
+    defineNative(vm, "weaktable", &msglobal_weaktable);
+    defineNative(vm, "remove", &msglobal_remove);
 }
 
 
@@ -300,3 +299,63 @@ bool msglobal_type(VM *vm, int argCount, bool shouldReturn) {
 
     return true;
 }
+
+bool msglobal_weaktable(VM* vm, int argCount, bool shouldReturn) {
+    if (argCount == 0) {
+        msapi_runtimeError(vm, "Expected the mode of the table in the 'weaktable()' function");
+        return false;
+    }
+
+    Value val = msapi_getArg(vm, 1, argCount);
+
+    if (!CHECK_STRING(val)) {
+        msapi_runtimeError(vm, "Expected the mode to be a string");
+        return false;
+    }
+
+    char* name = AS_NATIVE_STRING(val);
+    TableMode mode;
+
+    if (strcmp(name, "keys") == 0) {
+        mode = TABLE_WEAK_KEYS;
+    } else if (strcmp(name, "values") == 0) {
+        mode = TABLE_WEAK_VALUES;
+    } else if (strcmp(name, "ephemeron") == 0) {
+        mode = TABLE_EPHEMERON;
+    } else {
+        msapi_runtimeError(vm, "Unknown mode '%s', expected 'keys', 'values' or 'ephemeron'", name);
+        return false;
+    }
+
+    ObjTable* table = allocateWeakTable(vm, mode);
+    msapi_popn(vm, argCount + 1);
+
+    if (shouldReturn) {
+        msapi_push(vm, OBJ(table));
+    }
+
+    return true;
+}
+
+bool msglobal_remove(VM* vm, int argCount, bool shouldReturn) {
+    if (argCount == 0) {
+        msapi_runtimeError(vm, "Expected the path of the file in the 'remove()' global");
+        return false;
+    }
+
+    Value path = msapi_getArg(vm, 1, argCount);
+
+    if (!CHECK_STRING(path)) {
+        msapi_runtimeError(vm, "Expected the path to be a string");
+        return false;
+    }
+
+    bool removed = remove(AS_NATIVE_STRING(path)) == 0;
+    msapi_popn(vm, argCount + 1);
+
+    if (shouldReturn) {
+        msapi_push(vm, NATIVE_TO_BOOLEAN(removed));
+    }
+
+    return true;
+}
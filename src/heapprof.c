@@ -0,0 +1,460 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "../includes/heapprof.h"
+#include "../includes/gcollect.h"
+#include "../includes/table.h"
+#include "../includes/lib_ssocket.h"
+
+/* The profiler's own memory is plain heap memory, it isn't part of what is
+ * being measured and must not trigger collections */
+
+typedef void (*VisitFn)(void* data, Obj* obj);
+
+static void visitValue(VisitFn visit, void* data, Value value) {
+    if (CHECK_OBJ(value)) visit(data, AS_OBJ(value));
+}
+
+static void visitObject(VisitFn visit, void* data, Obj* obj) {
+    if (obj != NULL) visit(data, obj);
+}
+
+static void visitTable(VisitFn visit, void* data, Table* table) {
+    for (int i = 0; i < table->entryCount; i++) {
+        Entry* entry = &table->entries[i];
+
+        if (!CHECK_NIL(entry->key)) {
+            visitValue(visit, data, entry->key);
+            visitValue(visit, data, entry->value);
+        }
+    }
+
+    for (int i = 0; i < table->array.count; i++) {
+        visitValue(visit, data, table->array.values[i]);
+    }
+}
+
+static void visitPtrTable(VisitFn visit, void* data, PtrTable* table) {
+    for (int i = 0; i < table->capacity; i++) {
+        visitObject(visit, data, (Obj*)table->entries[i].key);
+    }
+}
+
+static void forEachReference(Obj* obj, VisitFn visit, void* data) {
+    /* Follows the same references as blackenObject, the edges of weak
+     * tables included */
+    switch (obj->type) {
+        case OBJ_CLOSURE: {
+            ObjClosure* closure = (ObjClosure*)obj;
+            visitObject(visit, data, (Obj*)closure->function);
+            visitObject(visit, data, (Obj*)closure->env);
+
+            for (int i = 0; i < closure->upvalueCount; i++) {
+                visitObject(visit, data, (Obj*)closure->upvalues[i]);
+            }
+            break;
+        }
+        case OBJ_UPVALUE:
+            visitValue(visit, data, ((ObjUpvalue*)obj)->closed);
+            break;
+        case OBJ_ARRAY: {
+            ValueArray* array = &((ObjArray*)obj)->array;
+            for (int i = 0; i < array->count; i++) visitValue(visit, data, array->values[i]);
+            break;
+        }
+        case OBJ_FUNCTION: {
+            ObjFunction* function = (ObjFunction*)obj;
+            visitObject(visit, data, (Obj*)function->name);
+
+            for (int i = 0; i < function->chunk.constants.count; i++) {
+                visitValue(visit, data, function->chunk.constants.values[i]);
+            }
+            break;
+        }
+        case OBJ_NATIVE_FUNCTION:
+            visitObject(visit, data, (Obj*)((ObjNativeFunction*)obj)->name);
+            break;
+        case OBJ_CLASS: {
+            ObjClass* klass = (ObjClass*)obj;
+            visitObject(visit, data, (Obj*)klass->name);
+            visitTable(visit, data, &klass->fields);
+            visitTable(visit, data, &klass->methods);
+            break;
+        }
+        case OBJ_INSTANCE: {
+            ObjInstance* instance = (ObjInstance*)obj;
+            visitObject(visit, data, (Obj*)instance->klass);
+            visitTable(visit, data, &instance->table);
+            break;
+        }
+        case OBJ_METHOD: {
+            ObjMethod* method = (ObjMethod*)obj;
+            visitObject(visit, data, (Obj*)method->closure);
+            visitObject(visit, data, (Obj*)method->self);
+            break;
+        }
+        case OBJ_TABLE:
+            visitTable(visit, data, &((ObjTable*)obj)->table);
+            break;
+        case OBJ_NATIVE_METHOD: {
+            ObjNativeMethod* nativeMethod = (ObjNativeMethod*)obj;
+            visitObject(visit, data, nativeMethod->self);
+            visitObject(visit, data, (Obj*)nativeMethod->name);
+            break;
+        }
+        case OBJ_DLL_CONTAINER:
+            visitObject(visit, data, (Obj*)((ObjDllContainer*)obj)->fileName);
+            visitObject(visit, data, (Obj*)((ObjDllContainer*)obj)->natives);
+            break;
+        case OBJ_COROUTINE: {
+            ObjCoroutine* coro = (ObjCoroutine*)obj;
+            visitObject(visit, data, (Obj*)coro->closure);
+
+            if (coro->frames != NULL) {
+                for (int i = 1; i < coro->frameCount; i++) {
+                    visitObject(visit, data, (Obj*)coro->frames[i].closure);
+                }
+            }
+
+            if (coro->stack != NULL) {
+                for (int i = 0; i < coro->stackSize; i++) visitValue(visit, data, coro->stack[i]);
+            }
+
+            for (ObjUpvalue* upvalue = coro->upvalues; upvalue != NULL; upvalue = upvalue->next) {
+                visitObject(visit, data, (Obj*)upvalue);
+            }
+            break;
+        }
+        default: return;
+    }
+}
+
+static void forEachRoot(VM* vm, VisitFn visit, void* data) {
+    /* Same roots as markRoots */
+    for (Value* slot = vm->stack; slot < vm->stackTop; slot++) {
+        visitValue(visit, data, *slot);
+    }
+
+    visitObject(visit, data, (Obj*)vm->globals);
+    visitPtrTable(visit, data, &vm->arrayMethods);
+    visitPtrTable(visit, data, &vm->stringMethods);
+    visitPtrTable(visit, data, &vm->tableMethods);
+    visitPtrTable(visit, data, &vm->dllMethods);
+    visitTable(visit, data, &vm->importCache);
+    visitTable(visit, data, &vm->resolvedImports);
+
+    for (int i = 0; i < vm->frameCount; i++) {
+        visitObject(visit, data, (Obj*)vm->frames[i].closure);
+    }
+
+    for (ObjUpvalue* upvalue = vm->UpvalueHead; upvalue != NULL; upvalue = upvalue->next) {
+        visitObject(visit, data, (Obj*)upvalue);
+    }
+
+    for (int i = 0; i < vm->moduleCount; i++) {
+        visitObject(visit, data, (Obj*)vm->modules[i].globals);
+        visitObject(visit, data, (Obj*)vm->modules[i].moduleName);
+        visitObject(visit, data, (Obj*)vm->modules[i].modulePath);
+    }
+}
+
+size_t heapObjectSize(Obj* obj) {
+    switch (obj->type) {
+        case OBJ_STRING: return sizeof(ObjString) + ((ObjString*)obj)->length + 1;
+        case OBJ_ARRAY: return sizeof(ObjArray) + ((ObjArray*)obj)->array.capacity * sizeof(Value);
+        case OBJ_UPVALUE: return sizeof(ObjUpvalue);
+        case OBJ_CLOSURE: return sizeof(ObjClosure) + ((ObjClosure*)obj)->upvalueCount * sizeof(ObjUpvalue*);
+        case OBJ_FUNCTION: {
+            Chunk* chunk = &((ObjFunction*)obj)->chunk;
+            return sizeof(ObjFunction) + chunk->capacity * sizeof(uint8_t)
+                + chunk->lineCapacity * sizeof(LineStart) + chunk->constants.capacity * sizeof(Value);
+        }
+        case OBJ_NATIVE_FUNCTION: return sizeof(ObjNativeFunction);
+        case OBJ_CLASS: {
+            ObjClass* klass = (ObjClass*)obj;
+            return sizeof(ObjClass) + tableMemory(&klass->fields) + tableMemory(&klass->methods);
+        }
+        case OBJ_INSTANCE: return sizeof(ObjInstance) + tableMemory(&((ObjInstance*)obj)->table);
+        case OBJ_METHOD: return sizeof(ObjMethod);
+        case OBJ_TABLE: return sizeof(ObjTable) + tableMemory(&((ObjTable*)obj)->table);
+        case OBJ_NATIVE_METHOD: return sizeof(ObjNativeMethod);
+        case OBJ_DLL_CONTAINER: return sizeof(ObjDllContainer);
+        case OBJ_SOCKET: return sizeof(ObjSocket);
+        case OBJ_SSOCKET: return sizeof(ObjSSocket) + (((ObjSSocket*)obj)->closed ? 0 : sizeof(SSOCKET));
+        case OBJ_COROUTINE: {
+            ObjCoroutine* coro = (ObjCoroutine*)obj;
+            return sizeof(ObjCoroutine) + (coro->frames != NULL ? coro->frameCount * sizeof(CallFrame) : 0)
+                + (coro->stack != NULL ? coro->stackSize * sizeof(Value) : 0);
+        }
+        default: return 0;
+    }
+}
+
+static const char* typeName(ObjType type) {
+    static const char* names[] = {
+        "string", "array", "upvalue", "closure", "function", "native", "class", "instance",
+        "method", "table", "nativemethod", "dll", "socket", "ssocket", "coroutine"
+    };
+
+    return names[type];
+}
+
+/* Allocation sites */
+
+static void growSlots(HeapProfiler* profiler) {
+    int capacity = profiler->slotCapacity == 0 ? 64 : profiler->slotCapacity * 2;
+    int* slots = (int*)calloc(capacity, sizeof(int));
+    if (slots == NULL) exit(1);
+
+    for (int site = 1; site < profiler->siteCount; site++) {
+        uint32_t slot = profiler->sites[site].hash & (capacity - 1);
+        while (slots[slot] != 0) slot = (slot + 1) & (capacity - 1);
+        slots[slot] = site;
+    }
+
+    free(profiler->slots);
+    profiler->slots = slots;
+    profiler->slotCapacity = capacity;
+}
+
+static int addSite(HeapProfiler* profiler, const char* function, int line, uint32_t hash) {
+    if (profiler->siteCapacity < profiler->siteCount + 1) {
+        profiler->siteCapacity = profiler->siteCapacity == 0 ? 64 : profiler->siteCapacity * 2;
+        profiler->sites = (AllocSite*)realloc(profiler->sites, profiler->siteCapacity * sizeof(AllocSite));
+        if (profiler->sites == NULL) exit(1);
+    }
+
+    AllocSite* site = &profiler->sites[profiler->siteCount];
+    site->function = (char*)malloc(strlen(function) + 1);
+    if (site->function == NULL) exit(1);
+    strcpy(site->function, function);
+    site->hash = hash;
+    site->line = line;
+    site->count = 0;
+    site->bytes = 0;
+
+    return profiler->siteCount++;
+}
+
+static int findSite(HeapProfiler* profiler, const char* function, int line) {
+    uint32_t hash = hash_string(function, strlen(function)) ^ ((uint32_t)line * 2654435761u);
+
+    /* Kept at most half full */
+    if ((profiler->siteCount + 1) * 2 > profiler->slotCapacity) growSlots(profiler);
+
+    uint32_t mask = profiler->slotCapacity - 1;
+    for (uint32_t slot = hash & mask;; slot = (slot + 1) & mask) {
+        int index = profiler->slots[slot];
+
+        if (index == 0) {
+            index = addSite(profiler, function, line, hash);
+            profiler->slots[slot] = index;
+            return index;
+        }
+
+        AllocSite* site = &profiler->sites[index];
+        if (site->hash == hash && site->line == line && strcmp(site->function, function) == 0) return index;
+    }
+}
+
+static int currentSite(VM* vm) {
+    /* The instruction which allocates is the last one read by the innermost
+     * frame, native functions allocate on behalf of their caller */
+    if (vm->frameCount == 0) return 0;
+
+    CallFrame* frame = &vm->frames[vm->frameCount - 1];
+    ObjFunction* function = frame->closure->function;
+    Chunk* chunk = &function->chunk;
+    int offset = (int)(frame->ip - chunk->code) - 1;
+
+    if (offset < 0 || offset >= chunk->elem_count) return 0;
+    return findSite(vm->profiler, function->name != NULL ? function->name->allocated : "script", getLine(chunk, offset));
+}
+
+void startProfiler(VM* vm) {
+    if (vm->profiler != NULL) return;
+
+    HeapProfiler* profiler = (HeapProfiler*)malloc(sizeof(HeapProfiler));
+    if (profiler == NULL) exit(1);
+
+    profiler->sites = NULL;
+    profiler->siteCount = 0;
+    profiler->siteCapacity = 0;
+    profiler->slots = NULL;
+    profiler->slotCapacity = 0;
+
+    /* Site 0, everything the profiler didn't see being allocated */
+    addSite(profiler, "<vm>", 0, 0);
+    vm->profiler = profiler;
+}
+
+void stopProfiler(VM* vm) {
+    HeapProfiler* profiler = vm->profiler;
+    if (profiler == NULL) return;
+
+    for (int i = 0; i < profiler->siteCount; i++) {
+        free(profiler->sites[i].function);
+    }
+
+    /* The tags would be stale once objects are allocated untagged */
+    for (PoolPage* page = vm->objects.pages; page != NULL; page = page->nextPage) {
+        free(page->sites);
+        page->sites = NULL;
+    }
+
+    free(profiler->sites);
+    free(profiler->slots);
+    free(profiler);
+    vm->profiler = NULL;
+}
+
+void profileAllocation(VM* vm, Obj* obj, size_t size) {
+    int index = currentSite(vm);
+    AllocSite* site = &vm->profiler->sites[index];
+    site->count++;
+    site->bytes += size;
+
+    PoolPage* page = poolPageOf(obj);
+    if (page->sites == NULL) {
+        page->sites = (uint32_t*)calloc(POOL_PAGE_SIZE / POOL_GRANULE, sizeof(uint32_t));
+        if (page->sites == NULL) exit(1);
+    }
+
+    page->sites[poolIndexOf(page, obj)] = (uint32_t)index;
+}
+
+static int objectSite(PoolPage* page, int index) {
+    return page->sites != NULL ? (int)page->sites[index] : 0;
+}
+
+typedef void (*ObjectFn)(void* data, PoolPage* page, int index);
+
+static void forEachObject(VM* vm, ObjectFn function, void* data) {
+    /* The pending sweep has to be finished first, or garbage 
+     * would be reported as well */
+    sweep(vm);
+
+    for (PoolPage* page = vm->objects.pages; page != NULL; page = page->nextPage) {
+        for (int word = 0; word < POOL_BITMAP_WORDS; word++) {
+            for (uint64_t bits = page->allocated[word]; bits != 0; bits &= bits - 1) {
+                function(data, page, word * 64 + countTrailingZeros(bits));
+            }
+        }
+    }
+}
+
+static int compareLiveBytes(const void* a, const void* b) {
+    size_t left = ((const SiteUsage*)a)->liveBytes;
+    size_t right = ((const SiteUsage*)b)->liveBytes;
+    return left < right ? 1 : left > right ? -1 : 0;
+}
+
+static void measureObject(void* data, PoolPage* page, int index) {
+    SiteUsage* site = &((SiteUsage*)data)[objectSite(page, index)];
+    site->liveCount++;
+    site->liveBytes += heapObjectSize((Obj*)poolBlockAt(page, index));
+}
+
+SiteUsage* measureSites(VM* vm, int* count) {
+    int sites = vm->profiler != NULL ? vm->profiler->siteCount : 1;
+    SiteUsage* usage = (SiteUsage*)calloc(sites, sizeof(SiteUsage));
+    if (usage == NULL) exit(1);
+
+    for (int i = 0; i < sites; i++) usage[i].site = i;
+
+    forEachObject(vm, measureObject, usage);
+
+    qsort(usage, sites, sizeof(SiteUsage), compareLiveBytes);
+    *count = sites;
+    return usage;
+}
+
+void writeProfileReport(VM* vm, FILE* file, int top) {
+    if (vm->profiler == NULL) {
+        fprintf(file, "The allocation profiler isn't running\n");
+        return;
+    }
+
+    int count;
+    SiteUsage* usage = measureSites(vm, &count);
+    AllocSite* sites = vm->profiler->sites;
+    size_t liveBytes = 0, liveCount = 0;
+
+    for (int i = 0; i < count; i++) {
+        liveBytes += usage[i].liveBytes;
+        liveCount += usage[i].liveCount;
+    }
+
+    fprintf(file, "Heap profile, %zu bytes in %zu objects\n\n", liveBytes, liveCount);
+    fprintf(file, "Retained by allocation site\n%14s %12s  %s\n", "live bytes", "objects", "site");
+
+    for (int i = 0; i < count && i < top && usage[i].liveBytes > 0; i++) {
+        AllocSite* site = &sites[usage[i].site];
+        fprintf(file, "%14zu %12zu  %s:%d\n", usage[i].liveBytes, usage[i].liveCount, site->function, site->line);
+    }
+
+    /* Same table sorted by what the sites allocated over time */
+    for (int i = 0; i < count; i++) {
+        usage[i].liveBytes = sites[usage[i].site].bytes;
+        usage[i].liveCount = sites[usage[i].site].count;
+    }
+
+    qsort(usage, count, sizeof(SiteUsage), compareLiveBytes);
+    fprintf(file, "\nAllocated by allocation site\n%14s %12s  %s\n", "bytes", "objects", "site");
+
+    for (int i = 0; i < count && i < top && usage[i].liveBytes > 0; i++) {
+        AllocSite* site = &sites[usage[i].site];
+        fprintf(file, "%14zu %12zu  %s:%d\n", usage[i].liveBytes, usage[i].liveCount, site->function, site->line);
+    }
+
+    free(usage);
+}
+
+/* Snapshots */
+
+typedef struct {
+    FILE* file;
+    long count;
+} Snapshot;
+
+static void writeId(void* data, Obj* obj) {
+    fprintf((FILE*)data, " %" PRIxPTR, (uintptr_t)obj);
+}
+
+static void writeObject(void* data, PoolPage* page, int index) {
+    Snapshot* snapshot = (Snapshot*)data;
+    Obj* obj = (Obj*)poolBlockAt(page, index);
+
+    fprintf(snapshot->file, "object %" PRIxPTR " %s %zu %d", (uintptr_t)obj, typeName(obj->type),
+            heapObjectSize(obj), objectSite(page, index));
+    forEachReference(obj, writeId, snapshot->file);
+    fprintf(snapshot->file, "\n");
+    snapshot->count++;
+}
+
+long writeHeapSnapshot(VM* vm, const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) return -1;
+
+    /* Only what survives a full collection is written */
+    gcCollect(vm);
+    fprintf(file, "megascript heap snapshot 1\n");
+
+    if (vm->profiler != NULL) {
+        for (int i = 0; i < vm->profiler->siteCount; i++) {
+            AllocSite* site = &vm->profiler->sites[i];
+            fprintf(file, "site %d %s %d\n", i, site->function, site->line);
+        }
+    }
+
+    fprintf(file, "roots");
+    forEachRoot(vm, writeId, file);
+    fprintf(file, "\n");
+
+    Snapshot snapshot = { file, 0 };
+    forEachObject(vm, writeObject, &snapshot);
+
+    bool failed = ferror(file);
+    if (fclose(file) != 0 || failed) return -1;
+    return snapshot.count;
+}
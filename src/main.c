@@ -5,12 +5,18 @@
 #include "../includes/compiler.h"
 #include "../includes/table.h"
 #include "../includes/object.h"
+#include "../includes/gcollect.h"
+#include "../includes/heapprof.h"
+#include "../includes/bytecache.h"
+#include "../includes/precompile.h"
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#define PROFILE_REPORT_SITES 20
+
 #define V_MAJOR 1
 #define V_MINOR 2
 
@@ -51,13 +57,42 @@ void cleanup(const char* source, VM* vm) {
     freeVM(vm);
 }
 
+static void applyGCFlags(VM* vm, FlagContainer flagContainer) {
+    /* The flags come after the environment, so they win over it */ 
+    for (int i = 0; i < flagContainer.gcOptionCount; i++) {
+        char* option = flagContainer.gcOptions[i];
+        char* value = strchr(option, '=');
+        *value = '\0';
+
+        if (!gcSetOption(vm, option, value + 1)) {
+            fprintf(stderr, "Invalid value '%s' for --gc-%s\n", value + 1, option);
+            exit(70);
+        }
+
+        *value = '=';
+    }
+}
+
+static void writeHeapReports(VM* vm, FlagContainer flagContainer) {
+    if (flagContainer.flags[FLAG_ALLOC_PROFILE]) {
+        writeProfileReport(vm, stderr, PROFILE_REPORT_SITES);
+    }
+
+    if (flagContainer.heapSnapshot != NULL && writeHeapSnapshot(vm, flagContainer.heapSnapshot) < 0) {
+        fprintf(stderr, "Could not write the heap snapshot to %s\n", flagContainer.heapSnapshot);
+    }
+}
+
 void runFile(const char* fileName, FlagContainer flagContainer) {
     char* source = readFile(fileName);
 
     VM vm;
     initVM(&vm);
+    applyGCFlags(&vm, flagContainer);
+    if (flagContainer.flags[FLAG_ALLOC_PROFILE]) startProfiler(&vm);
+    precompileImports(&vm, source);
     ObjFunction* function = newFunction(&vm, "main", 0);
-    InterpretResult result1 = compile(source, &vm, function, true);
+    InterpretResult result1 = compileCached(&vm, fileName, source, strlen(source), function, true);
 
     if (result1 == INTERPRET_COMPILE_ERROR) {
         if (flagContainer.flags[FLAG_DISSEMBLY]) {
@@ -74,6 +109,7 @@ void runFile(const char* fileName, FlagContainer flagContainer) {
     }
 
     InterpretResult result2 = interpret(&vm, function);
+    writeHeapReports(&vm, flagContainer);
     cleanup(source, &vm);
 
     if (result2 == INTERPRET_RUNTIME_ERROR) exit(101);
@@ -115,11 +151,22 @@ int main(int argc, char* argv[]) {
         return 0;
     }
 
+    if (strncmp("--embed=", argv[1], 8) == 0) {
+        /* Build step, compiles the files after it into a C file to link in */ 
+        VM vm;
+        initVM(&vm);
+        bool embedded = embedModules(&vm, argv[1] + 8, argv + 2, argc - 2);
+        freeVM(&vm);
+        return embedded ? 0 : 70;
+    }
+
     char* sourceFile = NULL; 
     
     // Flag 
     FlagContainer flagContainer;
     flagContainer.numFlags = 0;
+    flagContainer.gcOptionCount = 0;
+    flagContainer.heapSnapshot = NULL;
 
     for (int i = 0; i < FLAG_COUNT; i++) {
         flagContainer.flags[i] = false;
@@ -131,6 +178,17 @@ int main(int argc, char* argv[]) {
             if (strcmp("-d", argv[i]) == 0) {
                 flagContainer.numFlags++;
                 flagContainer.flags[FLAG_DISSEMBLY] = true;
+            } else if (strncmp("--gc-", argv[i], 5) == 0 && strchr(argv[i], '=') != NULL
+                    && flagContainer.gcOptionCount < GC_OPTION_MAX) {
+                /* --gc-<option>=<value>, checked once the vm exists */ 
+                flagContainer.numFlags++;
+                flagContainer.gcOptions[flagContainer.gcOptionCount++] = argv[i] + 5;
+            } else if (strcmp("--alloc-profile", argv[i]) == 0) {
+                flagContainer.numFlags++;
+                flagContainer.flags[FLAG_ALLOC_PROFILE] = true;
+            } else if (strncmp("--heap-snapshot=", argv[i], 16) == 0 && argv[i][16] != '\0') {
+                flagContainer.numFlags++;
+                flagContainer.heapSnapshot = argv[i] + 16;
             } else {
                 fprintf(stderr, "Unknown Flag\n");
                 return 70;
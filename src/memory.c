@@ -3,9 +3,31 @@
 #include "../includes/memory.h"
 #include "../includes/gcollect.h"
 #include "../includes/debug.h"
+#include "../includes/finalize.h"
+#include "../includes/precompile.h"
 
-void* reallocate(VM* vm, void* array, size_t oldSize, size_t newSize) {
+#ifdef PARALLEL_COMPILE
+static __thread VM* accountingVM = NULL;        /* Threads of the parallel compiler have vms of their own */
+#else
+static VM* accountingVM = NULL;
+#endif
+
+static inline void account(VM* vm, MemoryCategory category, size_t oldSize, size_t newSize) {
+    /* Unsigned wrap around makes this work for shrinking too */ 
+    vm->memory[category] += newSize - oldSize;
     vm->bytesAllocated += newSize - oldSize;
+}
+
+void setAccountingVM(VM* vm) {
+    accountingVM = vm;
+}
+
+void* reallocate(VM* vm, void* array, size_t oldSize, size_t newSize) {
+    return reallocateCategory(vm, MEMORY_OTHER, array, oldSize, newSize);
+}
+
+void* reallocateCategory(VM* vm, MemoryCategory category, void* array, size_t oldSize, size_t newSize) {
+    account(vm, category, oldSize, newSize);
     if (newSize > oldSize) {
 #ifdef DEBUG_STRESS_GC
         collectGarbage(vm);
@@ -13,6 +35,8 @@ void* reallocate(VM* vm, void* array, size_t oldSize, size_t newSize) {
         if (vm->bytesAllocated > vm->nextGC) {
             collectGarbage(vm);
         }
+
+        gcFinalize(vm);
     }
 
     if (newSize == 0) {
@@ -26,7 +50,39 @@ void* reallocate(VM* vm, void* array, size_t oldSize, size_t newSize) {
     return result;
 }
 
-void* reallocateArray(void* array, size_t oldSize, size_t newSize) {
+void* allocateBlock(VM* vm, Pool* pool, MemoryCategory category, size_t size) {
+    /* Same accounting and collection trigger as reallocate, but the 
+     * memory comes from one of the VMs pools */ 
+    account(vm, category, 0, size);
+#ifdef DEBUG_STRESS_GC
+    collectGarbage(vm);
+#endif
+    if (vm->bytesAllocated > vm->nextGC) {
+        collectGarbage(vm);
+    }
+
+    /* Pay off the garbage of the last collection a page at a time */ 
+    if (vm->gcPhase == GC_PHASE_SWEEP && vm->gcMode == GC_MODE_GENERATIONAL) {
+        gcSweepStep(vm);
+    }
+
+    void* block = poolAlloc(pool, size);
+    gcFinalize(vm);
+    return block;
+}
+
+void freeBlock(VM* vm, Pool* pool, MemoryCategory category, void* block, size_t size) {
+    if (block == NULL) return;
+    account(vm, category, size, 0);
+    poolFree(pool, block);
+}
+
+void* reallocateArray(MemoryCategory category, void* array, size_t oldSize, size_t newSize) {
+    /* Tables free their control bytes with a minimum size even when they never
+     * allocated any, nothing was accounted for a NULL array */ 
+    if (array == NULL) oldSize = 0;
+    if (accountingVM != NULL) account(accountingVM, category, oldSize, newSize);
+
     if (newSize == 0) {
         free(array);
         return NULL;
@@ -0,0 +1,29 @@
+#include <string.h>
+#include "../includes/modules.h"
+
+#ifdef MS_BUILTIN_MODULES
+extern const NativeModuleFunction socketModule[];
+extern const NativeModuleFunction ssocketModule[];
+extern const NativeModuleFunction coroutineModule[];
+extern const NativeModuleFunction gcModule[];
+
+static const BuiltinModule builtinModules[] = {
+    {"lib/_socket", socketModule},
+    {"lib/_ssocket", ssocketModule},
+    {"lib/_coroutine", coroutineModule},
+    {"lib/_gc", gcModule},
+    {NULL, NULL}
+};
+#else
+static const BuiltinModule builtinModules[] = {
+    {NULL, NULL}
+};
+#endif
+
+const NativeModuleFunction* findBuiltinModule(const char* path) {
+    for (const BuiltinModule* module = builtinModules; module->path != NULL; module++) {
+        if (strcmp(module->path, path) == 0) return module->functions;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,10 @@
+#include "../includes/bytecache.h"
+
+/* The table of embedded modules for the interpreter used to build the real 
+ * one, which is generated into stdlib.c by the Makefile */ 
+
+const EmbeddedModule embeddedModules[] = {
+    {NULL, NULL, 0}
+};
+
+const int embeddedModuleCount = 0;
@@ -8,13 +8,8 @@
 #include "../includes/table.h"
 #include "../includes/debug.h"
 #include "../includes/lib_ssocket.h"
-
-#ifdef _WIN32
-#include "../includes/win_dlfnc.h"
-#else 
-#include <dlfcn.h>
-#include <unistd.h>
-#endif
+#include "../includes/finalize.h"
+#include "../includes/heapprof.h"
 
 /*
     allocateObject allocates the given size which can be the size of any of its subsidaries (ObjString, ect) 
@@ -25,11 +20,11 @@
 */
 
 static Obj* allocateObject(VM* vm, size_t size, ObjType type) {
-    Obj* obj = (Obj*)reallocate(vm, NULL, 0, size);
+    MemoryCategory category = type == OBJ_STRING ? MEMORY_STRINGS : MEMORY_OBJECTS;
+    Obj* obj = (Obj*)allocateBlock(vm, &vm->objects, category, size);
     obj->type = type;
-    obj->next = vm->ObjHead;
-    obj->isMarked = false;
-    vm->ObjHead = obj;
+    obj->isRemembered = false;
+    if (vm->profiler != NULL) profileAllocation(vm, obj, size);
 
     #ifdef DEBUG_LOG_MEMORY
         printf("%p allocating %zu bytes for type %d\n", (void*)obj, size, type);
@@ -84,7 +79,7 @@ ObjString* allocateString(VM* vm, const char* chars, int length) {
 
 ObjString* allocateUnsourcedString(VM* vm, const char* chars, int length) {
     ObjString* stringObj = allocateString(vm, chars, length);
-    FREE_ARRAY(char, (char*)chars, length);
+    reallocateCategory(vm, MEMORY_STRINGS, (char*)chars, length, 0);
     return stringObj;
 }
 
@@ -105,7 +100,7 @@ ObjString* strConcat(VM* vm, Value val1, Value val2) {
 
     int length = str1->length + str2->length;
     
-    char* chars = ALLOCATE(vm, char, length);
+    char* chars = (char*)reallocateCategory(vm, MEMORY_STRINGS, NULL, 0, length);
 
     memcpy(chars, &str1->allocated, str1->length);
     memcpy(chars + str1->length, &str2->allocated, str2->length);
@@ -151,7 +146,7 @@ ObjNativeFunction* allocateNativeFunction(VM* vm, ObjString* name, NativeFuncPtr
 }
 
 ObjClosure* allocateClosure(VM* vm, ObjFunction* function, ObjTable* env) {
-    ObjUpvalue** upvalues = ALLOCATE(vm, ObjUpvalue*, function->upvalueCount);
+    ObjUpvalue** upvalues = (ObjUpvalue**)allocateBlock(vm, &vm->blocks, MEMORY_OBJECTS, sizeof(ObjUpvalue*) * function->upvalueCount);
     ObjClosure* closure = (ObjClosure*)allocateObject(vm, sizeof(ObjClosure), OBJ_CLOSURE);
     closure->function = function;
     closure->upvalues = upvalues;
@@ -168,6 +163,7 @@ ObjClosure* allocateClosure(VM* vm, ObjFunction* function, ObjTable* env) {
 ObjUpvalue* allocateUpvalue(VM* vm, Value* value) {
     ObjUpvalue* upvalue = (ObjUpvalue*)allocateObject(vm, sizeof(ObjUpvalue), OBJ_UPVALUE);
     upvalue->value = value;
+    upvalue->closed = NIL();
     upvalue->next = NULL;
     return upvalue; 
 }
@@ -197,7 +193,14 @@ ObjMethod* allocateMethod(VM* vm, ObjInstance* instance, ObjClosure* closure) {
 }
 
 ObjTable* allocateTable(VM* vm) {
+    return allocateWeakTable(vm, TABLE_STRONG);
+}
+
+ObjTable* allocateWeakTable(VM* vm, TableMode mode) {
     ObjTable* table = (ObjTable*)allocateObject(vm, sizeof(ObjTable), OBJ_TABLE);
+    table->mode = mode;
+    table->weakListed = false;
+    table->nextWeak = NULL;
     initTable(&table->table);
 
     return table;
@@ -211,6 +214,7 @@ ObjNativeMethod* allocateNativeMethod(VM* vm, ObjString* name, Obj* self,
     method->name = name;
     method->function = methodPtr;
     method->self = self;
+    method->arity = 0;
 
     return method;
 }
@@ -221,6 +225,7 @@ ObjDllContainer* allocateDllContainer(VM* vm, ObjString* fileName, void* handle)
 
     object->fileName = fileName;
     object->handle = handle;
+    object->natives = NULL;
     object->closed = false;
 
     return object;
@@ -304,18 +309,36 @@ void printObject(Value value) {
         
             bool first = false;
             printf("{");
-            for (int i = 0; i < table->table.capacity; i++) {
+            for (int i = 0; i < table->table.array.count; i++) {
+                Value value = table->table.array.values[i];
+
+                if (!CHECK_NIL(value)) {
+                    if (!first) {
+                        first = true;
+                    } else {
+                        printf(", ");
+                    }
+                    printf("%d : ", i);
+                    printValue(value);
+                }
+            }
+
+            for (int i = 0; i < table->table.entryCount; i++) {
                 Entry entry = table->table.entries[i];
 
-                if (entry.key != NULL) {
+                if (!CHECK_NIL(entry.key)) {
                     if (!first) {
                         first = true;
                     } else {
                         printf(", ");
                     }
-                    printf("\"");
-                    printObject(OBJ(entry.key));
-                    printf("\"");
+                    if (CHECK_STRING(entry.key)) {
+                        printf("\"");
+                        printValue(entry.key);
+                        printf("\"");
+                    } else {
+                        printValue(entry.key);
+                    }
                     printf(" : ");
                     printValue(entry.value);
                 }
@@ -353,14 +376,14 @@ void freeObject(VM* vm, Obj* obj) {
             /* Character array will automatically be freed because its 
              * allocated inside the struct due to being a flexible member */
             ObjString* stringObj = (ObjString*)obj;
-            reallocate(vm, stringObj, sizeof(*stringObj), 0);
+            freeBlock(vm, &vm->objects, MEMORY_STRINGS, stringObj, sizeof(*stringObj) + sizeof(char) * (stringObj->length + 1));
             break;
         }
         case OBJ_ARRAY: {
             /* Free the value array it contains, and the object itself */ 
             ObjArray* arrayObj = (ObjArray*)obj;
             freeValueArray(&arrayObj->array);
-            reallocate(vm, arrayObj, sizeof(ObjArray), 0);
+            freeBlock(vm, &vm->objects, MEMORY_OBJECTS, arrayObj, sizeof(ObjArray));
             break;
         } 
         case OBJ_FUNCTION: {
@@ -368,86 +391,68 @@ void freeObject(VM* vm, Obj* obj) {
             // NOTE : The name gets freed individually 
             ObjFunction* funcObj = (ObjFunction*)obj;
             freeChunk(&funcObj->chunk);
-            reallocate(vm, funcObj, sizeof(ObjFunction), 0);
+            freeBlock(vm, &vm->objects, MEMORY_OBJECTS, funcObj, sizeof(ObjFunction));
             break;
         }
         case OBJ_NATIVE_FUNCTION: {
             ObjNativeFunction* native = (ObjNativeFunction*)obj;
-            reallocate(vm, native, sizeof(ObjNativeFunction), 0);
+            freeBlock(vm, &vm->objects, MEMORY_OBJECTS, native, sizeof(ObjNativeFunction));
             break;
         }
         case OBJ_CLOSURE: {
             ObjClosure* closure = (ObjClosure*)obj;
-            FREE_ARRAY(ObjUpvalue*, closure->upvalues, closure->upvalueCount);
-            reallocate(vm, closure, sizeof(ObjClosure), 0);
+            freeBlock(vm, &vm->blocks, MEMORY_OBJECTS, closure->upvalues, sizeof(ObjUpvalue*) * closure->upvalueCount);
+            freeBlock(vm, &vm->objects, MEMORY_OBJECTS, closure, sizeof(ObjClosure));
             break;
         }
         case OBJ_UPVALUE: {
             ObjUpvalue* upvalue = (ObjUpvalue*)obj;
-            reallocate(vm, upvalue, sizeof(ObjUpvalue), 0);
+            freeBlock(vm, &vm->objects, MEMORY_OBJECTS, upvalue, sizeof(ObjUpvalue));
             break;
         }
         case OBJ_CLASS: {
             ObjClass* klass = (ObjClass*)obj;
             freeTable(&klass->methods);
             freeTable(&klass->fields); 
-            reallocate(vm, klass, sizeof(ObjClass), 0);
+            freeBlock(vm, &vm->objects, MEMORY_OBJECTS, klass, sizeof(ObjClass));
             break;
         }
         case OBJ_INSTANCE: {
             ObjInstance* instance = (ObjInstance*)obj;
             freeTable(&instance->table);
-            reallocate(vm, instance, sizeof(ObjInstance), 0);
+            freeBlock(vm, &vm->objects, MEMORY_OBJECTS, instance, sizeof(ObjInstance));
             break;
         }
         case OBJ_METHOD: {
-            reallocate(vm, (ObjMethod*)obj, sizeof(ObjMethod), 0);
+            freeBlock(vm, &vm->objects, MEMORY_OBJECTS, (ObjMethod*)obj, sizeof(ObjMethod));
             break;
         }
         case OBJ_TABLE: {
             ObjTable* table = (ObjTable*)obj;
             freeTable(&table->table);
-            reallocate(vm, table, sizeof(ObjTable), 0);
+            freeBlock(vm, &vm->objects, MEMORY_OBJECTS, table, sizeof(ObjTable));
             break;
         }
         case OBJ_NATIVE_METHOD: {
-            reallocate(vm, (ObjNativeMethod*)obj, sizeof(ObjNativeMethod), 0);
+            freeBlock(vm, &vm->objects, MEMORY_OBJECTS, (ObjNativeMethod*)obj, sizeof(ObjNativeMethod));
             break;
         }
         case OBJ_DLL_CONTAINER: {
             ObjDllContainer* container = (ObjDllContainer*)obj;
-
-            if (!container->closed) {
-                dlclose(container->handle);
-            }
-
-            reallocate(vm, container, sizeof(ObjDllContainer), 0);
+            queueFinalizer(vm, obj);
+            freeBlock(vm, &vm->objects, MEMORY_OBJECTS, container, sizeof(ObjDllContainer));
             break;
         }
         case OBJ_SOCKET: {
             ObjSocket* socket = (ObjSocket*)obj; 
-
-            if (!socket->closed) {
-                close(socket->sockfd);
-
-                printf("Warning : Unclosed Socket '%d'\n", socket->sockfd);
-            }
-            reallocate(vm, socket, sizeof(ObjSocket), 0);
+            queueFinalizer(vm, obj);
+            freeBlock(vm, &vm->objects, MEMORY_OBJECTS, socket, sizeof(ObjSocket));
             break;
         }
         case OBJ_SSOCKET: {
             ObjSSocket* ssocket = (ObjSSocket*)obj;
-
-
-            if (!ssocket->closed) {
-                BIO_free_all(ssocket->ssocket->ssl_bio);
-                SSL_CTX_free(ssocket->ssocket->ssl_ctx);
-
-                reallocateArray(ssocket->ssocket, sizeof(SSOCKET), 0);
-                printf("Warning : Unclosed Secure Socket");
-            }
-            
-            reallocate(vm, ssocket, sizeof(ObjSSocket), 0);
+            queueFinalizer(vm, obj);
+            freeBlock(vm, &vm->objects, MEMORY_OBJECTS, ssocket, sizeof(ObjSSocket));
             break;
         }
         case OBJ_COROUTINE: {
@@ -455,14 +460,14 @@ void freeObject(VM* vm, Obj* obj) {
             
             if (coro->frames != NULL) {
                 /* If a previous state was stored, we free the frames */
-                reallocate(vm, coro->frames, sizeof(CallFrame) * coro->frameCount, 0);
+                reallocateCategory(vm, MEMORY_COROUTINES, coro->frames, sizeof(CallFrame) * coro->frameCount, 0);
             }
 
             if (coro->stack != NULL) {
-                reallocate(vm, coro->stack, sizeof(Value) * coro->stackSize, 0);
+                reallocateCategory(vm, MEMORY_COROUTINES, coro->stack, sizeof(Value) * coro->stackSize, 0);
             }
              
-            reallocate(vm, coro, sizeof(ObjCoroutine), 0);
+            freeBlock(vm, &vm->objects, MEMORY_OBJECTS, coro, sizeof(ObjCoroutine));
             break;
         }
         default: return;
@@ -470,12 +475,13 @@ void freeObject(VM* vm, Obj* obj) {
 }
 
 void freeObjects(VM* vm) {
-    Obj* object = vm->ObjHead;
-    while (object != NULL) {
-        Obj* next = object->next;
-        freeObject(vm, object);
-        object = next;
+    /* Every allocated block of the objects pool is an object */ 
+    for (PoolPage* page = vm->objects.pages; page != NULL; page = page->nextPage) {
+        for (int word = 0; word < POOL_BITMAP_WORDS; word++) {
+            while (page->allocated[word] != 0) {
+                int bit = countTrailingZeros(page->allocated[word]);
+                freeObject(vm, (Obj*)poolBlockAt(page, word * 64 + bit));
+            }
+        }
     }
-
-    vm->ObjHead = NULL;
 }
@@ -0,0 +1,252 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "../includes/pool.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+/* When built with AddressSanitizer, free blocks are poisoned so that use
+ * after free bugs are still caught even though the memory stays mapped */
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/asan_interface.h>
+#define POISON(addr, size) ASAN_POISON_MEMORY_REGION(addr, size)
+#define UNPOISON(addr, size) ASAN_UNPOISON_MEMORY_REGION(addr, size)
+#else
+#define POISON(addr, size) ((void)(addr), (void)(size))
+#define UNPOISON(addr, size) ((void)(addr), (void)(size))
+#endif
+
+#define PAGE_HEADER_SIZE \
+    ((sizeof(PoolPage) + POOL_GRANULE - 1) / POOL_GRANULE * POOL_GRANULE)
+
+/* Classes are POOL_GRANULE apart up to POOL_SMALL_SIZE, then grow by a quarter
+ * of each power of two to keep the rounding waste below 25% */
+static const int classSizes[POOL_CLASSES] = {
+    16, 32, 48, 64, 80, 96, 112, 128, 144, 160, 176, 192, 208, 224, 240, 256,
+    320, 384, 448, 512, 640, 768, 896, 1024, 1280, 1536, 1792, 2048,
+    2560, 3072, 3584, 4096
+};
+
+static inline int sizeClassOf(size_t size) {
+    if (size <= POOL_SMALL_SIZE) return (int)((size - 1) / POOL_GRANULE);
+
+    int sizeClass = POOL_SMALL_SIZE / POOL_GRANULE;
+    while (classSizes[sizeClass] < (int)size) sizeClass++;
+    return sizeClass;
+}
+
+void initPool(Pool* pool) {
+    for (int i = 0; i < POOL_CLASSES; i++) {
+        pool->partial[i] = NULL;
+        pool->full[i] = NULL;
+    }
+
+    pool->sweeper = NULL;
+    pool->sweeperData = NULL;
+    pool->empty = NULL;
+    pool->pages = NULL;
+    pool->pageCount = 0;
+}
+
+static void* mapPage(size_t size) {
+#ifdef _WIN32
+    /* Allocations are already aligned to 64K on windows */
+    void* memory = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (memory == NULL) exit(1);
+    return memory;
+#else
+    /* mmap only aligns to the system page size, so an extra page is mapped
+     * and the unaligned ends are given back */
+    char* raw = mmap(NULL, size + POOL_PAGE_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) exit(1);
+
+    uintptr_t aligned = ((uintptr_t)raw + POOL_PAGE_SIZE - 1) & ~(uintptr_t)(POOL_PAGE_SIZE - 1);
+    size_t head = aligned - (uintptr_t)raw;
+
+    if (head > 0) munmap(raw, head);
+    munmap((char*)aligned + size, POOL_PAGE_SIZE - head);
+    return (void*)aligned;
+#endif
+}
+
+static void unmapPage(PoolPage* page) {
+    free(page->sites);
+    UNPOISON(page, page->mapSize);
+#ifdef _WIN32
+    VirtualFree(page, 0, MEM_RELEASE);
+#else
+    munmap(page, page->mapSize);
+#endif
+}
+
+static void unlinkPage(PoolPage** list, PoolPage* page) {
+    if (page->prev != NULL) {
+        page->prev->next = page->next;
+    } else {
+        *list = page->next;
+    }
+
+    if (page->next != NULL) page->next->prev = page->prev;
+    page->next = NULL;
+    page->prev = NULL;
+}
+
+static void linkPage(PoolPage** list, PoolPage* page) {
+    page->prev = NULL;
+    page->next = *list;
+    if (*list != NULL) (*list)->prev = page;
+    *list = page;
+}
+
+static PoolPage* newPage(Pool* pool, int sizeClass, size_t blockSize) {
+    size_t mapSize = POOL_PAGE_SIZE;
+
+    if (sizeClass == POOL_LARGE) {
+        size_t needed = PAGE_HEADER_SIZE + blockSize;
+        mapSize = (needed + POOL_PAGE_SIZE - 1) / POOL_PAGE_SIZE * POOL_PAGE_SIZE;
+    }
+
+    PoolPage* page = (PoolPage*)mapPage(mapSize);
+    memset(page, 0, PAGE_HEADER_SIZE);
+
+    page->mapSize = mapSize;
+    page->bump = (char*)page + PAGE_HEADER_SIZE;
+    page->sizeClass = sizeClass;
+    page->blockSize = (int)blockSize;
+    page->capacity = sizeClass == POOL_LARGE ? 1 :
+        (int)((POOL_PAGE_SIZE - PAGE_HEADER_SIZE) / blockSize);
+    page->end = page->bump + (size_t)page->capacity * blockSize;
+    POISON(page->bump, mapSize - PAGE_HEADER_SIZE);
+
+    /* Newest pages go first, so a sweep walking the list from a page
+     * never reaches the pages mapped after it started */
+    page->prevPage = NULL;
+    page->nextPage = pool->pages;
+    if (pool->pages != NULL) pool->pages->prevPage = page;
+    pool->pages = page;
+    pool->pageCount++;
+    return page;
+}
+
+void* poolAlloc(Pool* pool, size_t size) {
+    if (size == 0) return NULL;
+
+    PoolPage* page;
+
+    if (size > POOL_MAX_SIZE) {
+        size_t blockSize = (size + POOL_GRANULE - 1) / POOL_GRANULE * POOL_GRANULE;
+        page = newPage(pool, POOL_LARGE, blockSize);
+    } else {
+        int sizeClass = sizeClassOf(size);
+        page = pool->partial[sizeClass];
+
+        /* Sweeping can empty the page or fill the free list, so the 
+         * partial list is looked at again afterwards */ 
+        while (page != NULL && page->unswept) {
+            pool->sweeper(pool->sweeperData, page);
+            page = pool->partial[sizeClass];
+        }
+
+        if (page == NULL) {
+            page = newPage(pool, sizeClass, classSizes[sizeClass]);
+            linkPage(&pool->partial[sizeClass], page);
+        }
+    }
+
+    void* block;
+
+    if (page->freeList != NULL) {
+        block = page->freeList;
+        UNPOISON(block, page->blockSize);
+        page->freeList = *(void**)block;
+    } else {
+        block = page->bump;
+        UNPOISON(block, page->blockSize);
+        page->bump += page->blockSize;
+    }
+
+    page->used++;
+    POOL_SET_BIT(page->allocated, poolIndexOf(page, block));
+
+    if (page->sizeClass != POOL_LARGE && page->used == page->capacity) {
+        /* No blocks left, move it out of the way of the allocator */
+        unlinkPage(&pool->partial[page->sizeClass], page);
+        linkPage(&pool->full[page->sizeClass], page);
+    }
+
+    return block;
+}
+
+void poolFree(Pool* pool, void* block) {
+    if (block == NULL) return;
+
+    PoolPage* page = poolPageOf(block);
+    int index = poolIndexOf(page, block);
+
+    POOL_CLEAR_BIT(page->allocated, index);
+    POOL_CLEAR_BIT(page->marked, index);
+    POOL_CLEAR_BIT(page->old, index);
+
+    *(void**)block = page->freeList;
+    page->freeList = block;
+    POISON(block, page->blockSize);
+    page->used--;
+
+    if (page->sizeClass == POOL_LARGE) {
+        linkPage(&pool->empty, page);
+        return;
+    }
+
+    int sizeClass = page->sizeClass;
+
+    if (page->used == page->capacity - 1) {
+        unlinkPage(&pool->full[sizeClass], page);
+        linkPage(&pool->partial[sizeClass], page);
+    }
+
+    /* Empty pages are queued to be unmapped, unless it's the only page left
+     * for this class, which avoids mapping and unmapping a page over and over.
+     * They stay mapped until poolTrim, so a page can be freed from while it's
+     * being walked */
+    if (page->used == 0 && (page->prev != NULL || page->next != NULL)) {
+        unlinkPage(&pool->partial[sizeClass], page);
+        linkPage(&pool->empty, page);
+    }
+}
+
+static void releasePage(Pool* pool, PoolPage* page) {
+    if (page->prevPage != NULL) {
+        page->prevPage->nextPage = page->nextPage;
+    } else {
+        pool->pages = page->nextPage;
+    }
+
+    if (page->nextPage != NULL) page->nextPage->prevPage = page->prevPage;
+    unmapPage(page);
+    pool->pageCount--;
+}
+
+void poolTrim(Pool* pool) {
+    while (pool->empty != NULL) {
+        PoolPage* page = pool->empty;
+        pool->empty = page->next;
+        releasePage(pool, page);
+    }
+}
+
+void freePool(Pool* pool) {
+    PoolPage* page = pool->pages;
+
+    while (page != NULL) {
+        PoolPage* next = page->nextPage;
+        unmapPage(page);
+        page = next;
+    }
+
+    initPool(pool);
+}
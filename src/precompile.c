@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../includes/precompile.h"
+#include "../includes/bytecache.h"
+#include "../includes/scanner.h"
+#include "../includes/memory.h"
+
+#ifdef PARALLEL_COMPILE
+#include <pthread.h>
+#include <unistd.h>
+
+static char* readSource(VM* vm, const char* path, size_t* length) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+
+    fseek(file, 0, SEEK_END);
+    *length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char* source = (char*)reallocate(vm, NULL, 0, *length + 1);
+    source[fread(source, 1, *length, file)] = '\0';
+    fclose(file);
+
+    return source;
+}
+
+static void addImport(VM* vm, const char* name, int length) {
+    /* Resolves the path the way import does, which also saves the import
+     * from probing for it. Only scripts which aren't compiled into the 
+     * executable are of interest. The vm doesn't run yet, so nothing 
+     * is collected */
+    ObjString* path = resolveImport(vm, allocateString(vm, name, length));
+    if (path == NULL || findEmbeddedModule(path->allocated) != NULL) return;
+    if (path->length < 4 || memcmp(path->allocated + path->length - 4, ".meg", 4) != 0) return;
+
+    for (int i = 0; i < vm->precompiledCount; i++) {
+        if (strcmp(vm->precompiled[i].path, path->allocated) == 0) return;
+    }
+
+    if (vm->precompiledCount == vm->precompiledCapacity) {
+        int capacity = GROW_CAPACITY(vm->precompiledCapacity);
+        vm->precompiled = GROW_ARRAY(MEMORY_OTHER, PrecompiledModule, vm->precompiled,
+                                     vm->precompiledCapacity, capacity);
+        vm->precompiledCapacity = capacity;
+    }
+
+    PrecompiledModule* module = &vm->precompiled[vm->precompiledCount++];
+    module->path = (char*)reallocate(vm, NULL, 0, path->length + 1);
+    memcpy(module->path, path->allocated, path->length + 1);
+    module->source = NULL;
+    module->sourceLength = 0;
+    module->bytecode = NULL;
+    module->length = 0;
+}
+
+static void scanImports(VM* vm, const char* source) {
+    /* Only imports of a string path can be found ahead of time,
+     * the scanner doesn't see whether they are ever run */
+    Scanner scanner;
+    initScanner(&scanner, source);
+    TokenTyp previous = TOKEN_EOF;
+
+    for (;;) {
+        Token token = scanToken(&scanner);
+        if (token.type == TOKEN_EOF) break;
+
+        if (previous == TOKEN_IMPORT && token.type == TOKEN_STRING) {
+            addImport(vm, token.start + 1, token.length - 2);
+        }
+
+        previous = token.type;
+    }
+}
+
+typedef struct {
+    VM* vm;                         /* Only its list of modules is touched by the threads */
+    int next;                       /* Next module to compile */
+} CompileQueue;
+
+static void* compileThread(void* data) {
+    CompileQueue* queue = (CompileQueue*)data;
+
+    /* The vm of the thread is the arena of the compiler, it never collects
+     * since it never runs, and everything in it is freed at once */
+    VM* vm = (VM*)malloc(sizeof(VM));
+    if (vm == NULL) exit(1);
+    initVM(vm);
+    vm->silentErrors = true;
+
+    for (;;) {
+        int index = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED);
+        if (index >= queue->vm->precompiledCount) break;
+
+        PrecompiledModule* module = &queue->vm->precompiled[index];
+        if (module->source == NULL) continue;
+
+        module->bytecode = precompileModule(vm, module->path, module->source,
+                                            module->sourceLength, &module->length);
+    }
+
+    freeVM(vm);
+    free(vm);
+    return NULL;
+}
+
+static int compileThreads() {
+    char* value = getenv("MEGA_COMPILE_THREADS");
+    if (value == NULL) return 1;
+
+    char* end;
+    long threads = strtol(value, &end, 10);
+
+    if (end == value || *end != '\0' || threads < 0) {
+        fprintf(stderr, "Ignoring invalid value '%s' of MEGA_COMPILE_THREADS\n", value);
+        return 1;
+    }
+
+    if (threads == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? cores : 1;
+    }
+
+    return threads > COMPILE_MAX_THREADS ? COMPILE_MAX_THREADS : (int)threads;
+}
+
+void precompileImports(VM* vm, const char* source) {
+    int threadCount = compileThreads();
+    if (threadCount <= 1) return;
+
+    /* The graph is walked breadth first, the list grows while it is read */
+    scanImports(vm, source);
+
+    for (int i = 0; i < vm->precompiledCount; i++) {
+        PrecompiledModule* module = &vm->precompiled[i];
+        module->source = readSource(vm, module->path, &module->sourceLength);
+        if (module->source != NULL) scanImports(vm, module->source);
+    }
+
+    if (threadCount > vm->precompiledCount) threadCount = vm->precompiledCount;
+
+    CompileQueue queue = {vm, 0};
+    pthread_t threads[COMPILE_MAX_THREADS];
+    int started = 0;
+
+    /* Without any thread every import compiles its script as usual */
+    while (started < threadCount && pthread_create(&threads[started], NULL, compileThread, &queue) == 0) {
+        started++;
+    }
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int i = 0; i < vm->precompiledCount; i++) {
+        PrecompiledModule* module = &vm->precompiled[i];
+        if (module->source == NULL) continue;
+
+        reallocate(vm, module->source, module->sourceLength + 1, 0);
+        module->source = NULL;
+    }
+}
+
+#else
+
+void precompileImports(VM* vm, const char* source) {
+}
+
+#endif
+
+bool loadPrecompiled(VM* vm, const char* path, ObjFunction* function) {
+    for (int i = 0; i < vm->precompiledCount; i++) {
+        PrecompiledModule* module = &vm->precompiled[i];
+        if (module->bytecode == NULL || strcmp(module->path, path) != 0) continue;
+
+        /* The bytecode is only needed once, the import is cached after */
+        bool loaded = loadBytecode(vm, module->bytecode, module->length, function);
+        free(module->bytecode);
+        module->bytecode = NULL;
+
+        return loaded;
+    }
+
+    return false;
+}
+
+void freePrecompiled(VM* vm) {
+    for (int i = 0; i < vm->precompiledCount; i++) {
+        PrecompiledModule* module = &vm->precompiled[i];
+
+        reallocate(vm, module->path, strlen(module->path) + 1, 0);
+        if (module->source != NULL) reallocate(vm, module->source, module->sourceLength + 1, 0);
+        free(module->bytecode);
+    }
+
+    FREE_ARRAY(MEMORY_OTHER, PrecompiledModule, vm->precompiled, vm->precompiledCapacity);
+    vm->precompiled = NULL;
+    vm->precompiledCount = 0;
+    vm->precompiledCapacity = 0;
+}
@@ -27,15 +27,6 @@ static Token makeToken(Scanner* scanner, TokenTyp type) {
     return token;
 }
 
-static TokenTyp checkKeyword(Scanner* scanner, int start, int length, const char* rest, TokenTyp type) {
-    if (scanner->current - scanner->start == start + length && (memcmp((char*)scanner->start + start, rest, length) == 0)) {
-        /* If the length of the characters is same and the characters themselves are same then 
-         * return the given type, otherwise return identifier */
-        return type;
-    }
-    return TOKEN_IDENTIFIER;
-}
-
 static bool isAtEnd(Scanner* scanner) {
     return *scanner->current == '\0';
 }
@@ -65,73 +56,196 @@ static char peekNext(Scanner* scanner) {
     return scanner->current[1];
 }
 
+/* - - - - - - - - Character classes - - - - - - - - */
+
+#define CHAR_ALPHA 1                /* Letters and '_' */
+#define CHAR_DIGIT 2
+#define CHAR_BLANK 4                /* Whitespace other than newlines */
+
+#define A CHAR_ALPHA
+#define D CHAR_DIGIT
+#define B CHAR_BLANK
+
+static const uint8_t charClasses[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, B, 0, 0, 0, B, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    B, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    D, D, D, D, D, D, D, D, D, D, 0, 0, 0, 0, 0, 0,
+    0, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A,
+    A, A, A, A, A, A, A, A, A, A, A, 0, 0, 0, 0, A,
+    0, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A,
+    A, A, A, A, A, A, A, A, A, A, A, 0, 0, 0, 0, 0,
+    /* Bytes above 127 belong to no class */
+};
+
+#undef A
+#undef D
+#undef B
+
+static bool isDigit(char c) {
+    return charClasses[(uint8_t)c] & CHAR_DIGIT;
+}
+
+static bool isAlpha(char c) {
+    return charClasses[(uint8_t)c] & CHAR_ALPHA;
+}
+
+static bool isAlphaNumeric(char c) {
+    return charClasses[(uint8_t)c] & (CHAR_ALPHA | CHAR_DIGIT);
+}
+
+/* - - - - - - - - Skipping - - - - - - - - */
+
+#ifdef SCANNER_SIMD
+#include <emmintrin.h>
+
+/* The loads are aligned, so one never touches a page which holds none of the
+ * source, but they do read past its end, which ASan would report */
+#if defined(__clang__) || defined(__GNUC__)
+#define NO_ASAN __attribute__((no_sanitize_address))
+#else
+#define NO_ASAN
+#endif
+
+static NO_ASAN const char* findAny(const char* current, char a, char b, char c) {
+    /* The first byte from current on which is a, b, c or the terminator */
+    uintptr_t offset = (uintptr_t)current & 15;
+    const __m128i* block = (const __m128i*)(current - offset);
+    __m128i va = _mm_set1_epi8(a);
+    __m128i vb = _mm_set1_epi8(b);
+    __m128i vc = _mm_set1_epi8(c);
+    __m128i zero = _mm_setzero_si128();
+
+    /* Bytes before current are masked off in the first block */
+    unsigned int skipped = 0xFFFFu << offset;
+
+    for (;;) {
+        __m128i bytes = _mm_load_si128(block);
+        __m128i found = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, va), _mm_cmpeq_epi8(bytes, vb)),
+                                     _mm_or_si128(_mm_cmpeq_epi8(bytes, vc), _mm_cmpeq_epi8(bytes, zero)));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(found) & skipped;
+
+        if (mask != 0) return (const char*)block + __builtin_ctz(mask);
+        skipped = 0xFFFFu;
+        block++;
+    }
+}
+
+static NO_ASAN const char* skipBlanks(const char* current) {
+    /* The first byte from current on which isn't blank, the terminator never is */
+    uintptr_t offset = (uintptr_t)current & 15;
+    const __m128i* block = (const __m128i*)(current - offset);
+    __m128i space = _mm_set1_epi8(' ');
+    __m128i tab = _mm_set1_epi8('\t');
+    __m128i carriage = _mm_set1_epi8('\r');
+    unsigned int skipped = 0xFFFFu << offset;
+
+    for (;;) {
+        __m128i bytes = _mm_load_si128(block);
+        __m128i blank = _mm_or_si128(_mm_cmpeq_epi8(bytes, space),
+                                     _mm_or_si128(_mm_cmpeq_epi8(bytes, tab), _mm_cmpeq_epi8(bytes, carriage)));
+        unsigned int mask = ~(unsigned int)_mm_movemask_epi8(blank) & skipped;
+
+        if (mask != 0) return (const char*)block + __builtin_ctz(mask);
+        skipped = 0xFFFFu;
+        block++;
+    }
+}
+
+#else
+
+static const char* findAny(const char* current, char a, char b, char c) {
+    while (*current != a && *current != b && *current != c && *current != '\0') current++;
+    return current;
+}
+
+static const char* skipBlanks(const char* current) {
+    while (charClasses[(uint8_t)*current] & CHAR_BLANK) current++;
+    return current;
+}
+
+#endif
+
+static const char* skipBlockComment(Scanner* scanner, const char* current) {
+    /* current is on the '*' which opened it */
+    for (;;) {
+        current = findAny(current, '*', '\n', '\n');
+
+        switch (*current) {
+            case '\0': return current;
+            case '\n':
+                scanner->line++;
+                current++;
+                break;
+            default:
+                if (current[1] == '/') return current + 2;
+                current++;
+                break;
+        }
+    }
+}
+
 static void skipWhitespace(Scanner* scanner) {
+    const char* current = scanner->current;
+
     for (;;) {
-        char c = peek(scanner);
-        switch(c) {
+        switch (*current) {
             case ' ':
             case '\r':
             case '\t':
-                advance(scanner);
+                /* Mostly a single space between two tokens */
+                if (charClasses[(uint8_t)current[1]] & CHAR_BLANK) {
+                    current = skipBlanks(current);
+                } else {
+                    current++;
+                }
                 break;
             case '\n':
                 scanner->line++;
-                advance(scanner);
+                current++;
                 break;
             case '/':
-                if (peekNext(scanner) == '/') {
-                    while ((peek(scanner) != '\n') && !isAtEnd(scanner)) advance(scanner);
-                } else if (peekNext(scanner) == '*') {
-
-                    for (;;) {
-                        if (peek(scanner) == '*' && peekNext(scanner) == '/') {
-                            advance(scanner);
-                            advance(scanner);
-                            advance(scanner);
-                            break;
-                        }
-                        if (isAtEnd(scanner)) break;
-                        advance(scanner);
-                    }
-                    break;
+                if (current[1] == '/') {
+                    current = findAny(current + 2, '\n', '\n', '\n');
+                } else if (current[1] == '*') {
+                    current = skipBlockComment(scanner, current + 1);
                 } else {
+                    scanner->current = current;
                     return;
                 }
                 break;
             default:
+                scanner->current = current;
                 return;
         }
     }
 }
 
-static bool isDigit(char c) {
-    return (c >= '0' && c <= '9');
-}
+static Token scanString(Scanner* scanner, char type) {
+    const char* current = scanner->current;
+    bool lastWasSlash = false;
 
-static bool isAlpha(char c) {
-    return (c >= 'a' && c <= 'z') ||
-           (c >= 'A' && c <= 'Z') ||
-           (c == '_');
-}
+    for (;;) {
+        /* Everything up to the next quote, backslash or newline is plain */
+        const char* special = findAny(current, type, '\\', '\n');
+        if (special != current) lastWasSlash = false;
+        current = special;
 
-static bool isAlphaNumeric(char c) {
-    return isAlpha(c) || isDigit(c);
-}
+        if (*current == '\0' || *current == type) break;
 
-static Token scanString(Scanner* scanner, char type) {
-    bool lastWasSlash = false;
-    while (!isAtEnd(scanner)) {
-        if (peek(scanner) == type) break;
-        if (peek(scanner) == '\\') {
-            if (peekNext(scanner) == type && !lastWasSlash) advance(scanner);
+        if (*current == '\\') {
+            if (current[1] == type && !lastWasSlash) current++;
             lastWasSlash = true;
         } else {
             lastWasSlash = false;
+            scanner->line++;
         }
-        if (peek(scanner) == '\n') scanner->line++;
-        advance(scanner);
+
+        current++;
     }
 
+    scanner->current = current;
+
     if (isAtEnd(scanner)) {
         return makeError(scanner, "Expected String Termination");
     }
@@ -141,7 +255,7 @@ static Token scanString(Scanner* scanner, char type) {
 }
 
 static Token scanNumber(Scanner* scanner) {
-    while (isDigit(peek(scanner)) && !isAtEnd(scanner)) {
+    while (isDigit(peek(scanner))) {
         advance(scanner);
     }
 
@@ -149,7 +263,7 @@ static Token scanNumber(Scanner* scanner) {
         if (peekNext(scanner) != '.') {
             advance(scanner);       /* Consume the decimal point */ 
         
-            while (isDigit(peek(scanner)) && !isAtEnd(scanner)) {
+            while (isDigit(peek(scanner))) {
                 advance(scanner);
             }
         }
@@ -158,81 +272,62 @@ static Token scanNumber(Scanner* scanner) {
     return makeToken(scanner, TOKEN_NUMBER);
 }
 
+/* - - - - - - - - Keywords - - - - - - - - */
+
+/* A perfect hash of the keywords, every one of them lands in a slot of its own.
+ * An identifier is looked up in the single slot it hashes to */
+#define KEYWORD_HASH(start, length) \
+    (((uint8_t)(start)[0] * 2 + (uint8_t)(start)[(length) - 1] * 23 + (length)) & 63)
+
+#define KEYWORD_MIN 2
+#define KEYWORD_MAX 8
+
+typedef struct {
+    const char* name;
+    int length;
+    TokenTyp type;
+} Keyword;
+
+static const Keyword keywords[64] = {
+    [1] = {"and", 3, TOKEN_AND},
+    [4] = {"import", 6, TOKEN_IMPORT},
+    [6] = {"while", 5, TOKEN_WHILE},
+    [8] = {"global", 6, TOKEN_GLOBAL},
+    [9] = {"end", 3, TOKEN_END},
+    [12] = {"return", 6, TOKEN_RETURN},
+    [13] = {"for", 3, TOKEN_FOR},
+    [19] = {"nil", 3, TOKEN_NIL},
+    [20] = {"self", 4, TOKEN_SELF},
+    [30] = {"or", 2, TOKEN_OR},
+    [32] = {"class", 5, TOKEN_CLASS},
+    [33] = {"else", 4, TOKEN_ELSE},
+    [36] = {"false", 5, TOKEN_FALSE},
+    [38] = {"break", 5, TOKEN_BREAK},
+    [41] = {"super", 5, TOKEN_SUPER},
+    [45] = {"var", 3, TOKEN_VAR},
+    [47] = {"inherits", 8, TOKEN_INHERITS},
+    [53] = {"func", 4, TOKEN_FUNC},
+    [54] = {"in", 2, TOKEN_IN},
+    [58] = {"elseif", 6, TOKEN_ELSEIF},
+    [62] = {"if", 2, TOKEN_IF},
+    [63] = {"true", 4, TOKEN_TRUE},
+};
+
 static Token scanIdentifier(Scanner* scanner) {
-   while (isAlphaNumeric(peek(scanner))) advance(scanner);
-   TokenTyp type = TOKEN_IDENTIFIER;
-
-   switch (scanner->start[0]) {
-       case 'a': type = checkKeyword(scanner, 1, 2, "nd", TOKEN_AND); break;
-       case 'b': type = checkKeyword(scanner, 1, 4, "reak", TOKEN_BREAK); break;
-       case 'o': type = checkKeyword(scanner, 1, 1, "r", TOKEN_OR); break;
-       case 'w': type = checkKeyword(scanner, 1, 4, "hile", TOKEN_WHILE); break;
-       case 'f':
-            if (scanner->current - scanner->start > 1) {    /* If identifier length is greater than 1 */
-                switch (scanner->start[1]) {
-                    case 'o': type = checkKeyword(scanner, 2, 1, "r", TOKEN_FOR); break;
-                    case 'a': type = checkKeyword(scanner, 2, 3, "lse", TOKEN_FALSE); break;
-                    case 'u': type = checkKeyword(scanner, 2, 2, "nc", TOKEN_FUNC); break;
-                }
-            }
-            break;
-       case 't': type = checkKeyword(scanner, 1, 3, "rue", TOKEN_TRUE); break;
-       case 'i': 
-            type = checkKeyword(scanner, 1, 1, "f", TOKEN_IF); 
-            if (type == TOKEN_IDENTIFIER) {
-                if (scanner->current - scanner->start > 1) {
-                    switch (scanner->start[1]) {
-                        case 'n': {
-                            if (scanner->current - scanner->start > 2) {
-                                type = checkKeyword(scanner, 2, 6, "herits", TOKEN_INHERITS);
-                            } else {
-                                type = TOKEN_IN;
-                            }
-                            break;
-                        }
-                        case 'm': type = checkKeyword(scanner, 2, 4, "port", TOKEN_IMPORT); break;
-                    }
-                }
-            }
-            break;
-       case 'e': 
-            if (scanner->current - scanner->start > 1) {
-                switch (scanner->start[1]) {
-                    case 'l':
-                        type = checkKeyword(scanner, 2, 2, "se", TOKEN_ELSE);
-                        
-                        /* If 'else' fails, try 'elseif' */
-                        if (type == TOKEN_IDENTIFIER) {
-                            type = checkKeyword(scanner, 2, 4, "seif", TOKEN_ELSEIF); break;
-                        }
-                        break;
-                    case 'n': type = checkKeyword(scanner, 2, 1, "d", TOKEN_END); break;
-                }
-            }
-            break;
-        case 'c': 
-            if (scanner->current - scanner->start > 1) {
-                switch (scanner->start[1]) {
-                    case 'l': type = checkKeyword(scanner, 2, 3, "ass", TOKEN_CLASS); break;
-                }
-            }
-            break;
-        case 'v': type = checkKeyword(scanner, 1, 2, "ar", TOKEN_VAR); break;
-        case 'r': type = checkKeyword(scanner, 1, 5, "eturn", TOKEN_RETURN); break;
-        case 'n': type = checkKeyword(scanner, 1, 2, "il", TOKEN_NIL); break;
-        case 'g': type = checkKeyword(scanner, 1, 5, "lobal", TOKEN_GLOBAL); break;
-        case 's': {
-            type = checkKeyword(scanner, 1, 3, "elf", TOKEN_SELF);
-        
-            if (type == TOKEN_IDENTIFIER) {
-                type = checkKeyword(scanner, 1, 4, "uper", TOKEN_SUPER);
-                break;
-            }
-            break;
+    while (isAlphaNumeric(peek(scanner))) advance(scanner);
+
+    int length = (int)(scanner->current - scanner->start);
+    TokenTyp type = TOKEN_IDENTIFIER;
+
+    if (length >= KEYWORD_MIN && length <= KEYWORD_MAX) {
+        const Keyword* keyword = &keywords[KEYWORD_HASH(scanner->start, length)];
+
+        if (keyword->length == length && memcmp(scanner->start, keyword->name, length) == 0) {
+            type = keyword->type;
         }
-   }
+    }
 
-   return makeToken(scanner, type);
+    return makeToken(scanner, type);
 }
 
 Token scanToken(Scanner* scanner) {
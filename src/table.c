@@ -5,205 +5,477 @@
 #include <string.h>
 #include <stdint.h>
 
+#if defined(TABLE_SIMD_PROBING) && defined(__SSE2__)
+#include <emmintrin.h>
+#define TABLE_SSE2
+#endif
+
 
 
 void initTable(Table* table) {
     /* Set default fields */
     table->capacity = 0;
     table->count = 0;
+    table->entryCount = 0;
+    table->ctrl = NULL;
+    table->index = NULL;
     table->entries = NULL;
+    initValueArray(&table->array);
 }
 
 void initPtrTable(PtrTable* table) {
     table->capacity = 0;
     table->count = 0;
+    table->ctrl = NULL;
     table->entries = NULL;
 }
 
-static Entry* probeEntrySlot(Entry* entries, int capacity, ObjString* key) {
-    uint32_t index = key->obj.hash & (capacity - 1);
-    for (;;) {
-        Entry* entry = &entries[index];
-        Entry* tombstone = NULL;
-        /* NOTE : We can compare 2 keys directly because strings are interned */
-        
-        if (entry->key == NULL) {
-            if (!(CHECK_NIL(entry->value))) {
-                // Tombstone
-                if (tombstone == NULL) tombstone = entry;
-            } else {
-                // truly empty entry / previous tombstone 
-
-                return tombstone == NULL ? entry : tombstone;
-            }
-        } else if (entry->key == key) {
-            /* We found its own key */
-            return entry;
+/* Keys
+ *
+ * Any value except nil and NaN can be used as a key. Strings are interned and other
+ * objects compare by identity, so objects only need a pointer comparison, numbers
+ * compare by value. Strings carry their hash, everything else gets hashed here */
+
+static inline uint32_t mixHash(uint64_t bits) {
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdull;
+    bits ^= bits >> 33;
+    return (uint32_t)bits;
+}
+
+static inline uint32_t hashValue(Value key) {
+    switch (key.type) {
+        case VAL_OBJ: {
+            Obj* obj = AS_OBJ(key);
+            if (obj->type == OBJ_STRING) return obj->hash;
+            return mixHash((uint64_t)(uintptr_t)obj);
         }
-        
-        /* the entry wasnt empty, so continue the linear search */
-        index = (index + 1) & (capacity - 1);
-    }
-    
-}
-
-static PtrEntry* probePtrEntrySlot(PtrEntry* entries, int capacity, ObjString* key) {
-    uint32_t index = key->obj.hash & (capacity - 1);
-    for (;;) {
-        PtrEntry* entry = &entries[index];
-        PtrEntry* tombstone = NULL;
-        /* NOTE : We can compare 2 keys directly because strings are interned */
-        
-        if (entry->key == NULL) {
-            if (entry->tombstone) {
-                // Tombstone
-                if (tombstone == NULL) tombstone = entry;
-            } else {
-                // truly empty entry / previous tombstone 
-
-                return tombstone == NULL ? entry : tombstone;
-            }
-        } else if (entry->key == key) {
-            /* We found its own key */
-            return entry;
+        case VAL_NUMBER: {
+            /* 0 and -0 are equal keys, so they need the same hash */
+            double number = AS_NUMBER(key) == 0 ? 0 : AS_NUMBER(key);
+            uint64_t bits;
+            memcpy(&bits, &number, sizeof(double));
+            return mixHash(bits);
         }
-        
-        /* the entry wasnt empty, so continue the linear search */
-        index = (index + 1) & (capacity - 1);
+        case VAL_BOOL: return AS_BOOL(key) ? 1 : 2;
+        default: return 0;
     }
-    
 }
 
+static inline bool keysEqual(Value a, Value b) {
+    if (a.type != b.type) return false;
 
+    switch (a.type) {
+        case VAL_OBJ: return AS_OBJ(a) == AS_OBJ(b);
+        case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
+        case VAL_BOOL: return AS_BOOL(a) == AS_BOOL(b);
+        default: return false;
+    }
+}
 
-static void adjustCapacity(Table* table, int capacity) {
-    /* The entries are positioned relative to the older capacity, to make sure 
-     * the probe sequence remains problem free and returns the current result
-     * after changing the capacity, they have to be reinserted completely */  
-    Entry* entries = ALLOCATE_ARRAY(Entry, capacity);
-    table->count = 0;
-    /* Reset all slots back to NULL */ 
-    for (int i = 0; i < capacity; i++) {
-        entries[i].key = NULL;
-        entries[i].value = NIL();
+bool isValidTableKey(Value key) {
+    if (CHECK_NIL(key)) return false;
+    if (CHECK_NUMBER(key) && AS_NUMBER(key) != AS_NUMBER(key)) return false;         /* NaN */
+    return true;
+}
+
+static inline int arraySlot(Value key) {
+    /* Returns the array part slot a key maps to, or -1 if it isn't a non negative integer */
+    if (!CHECK_NUMBER(key)) return -1;
+
+    double number = AS_NUMBER(key);
+    if (!(number >= 0 && number < INT32_MAX)) return -1;
+    if ((double)(int)number != number) return -1;
+
+    return (int)number;
+}
+
+/* Control bytes
+ *
+ * Both kinds of hash tables keep a control byte for every slot. Full slots store the
+ * low 7 bits of their key's hash, empty and deleted slots have the high bit set.
+ * Probing goes over aligned groups of GROUP_WIDTH slots, the hash fragment is compared
+ * against every control byte in the group at once and only the matching slots get their
+ * keys compared. A lookup stops at the first group which has an empty slot. Tables
+ * smaller than a group use a single partial group, masked down to their capacity */
+
+#define GROUP_WIDTH 16
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xFE
+#define H1(hash) ((hash) >> 7)                  /* Picks the first group */
+#define H2(hash) ((uint8_t)((hash) & 0x7F))     /* Stored in the control byte */
+
+static inline uint32_t matchByte(const uint8_t* group, uint8_t byte) {
+    /* Bitmask of the slots in the group whose control byte is 'byte' */
+#ifdef TABLE_SSE2
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)byte)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < GROUP_WIDTH; i++) {
+        if (group[i] == byte) mask |= 1u << i;
     }
-    
-    /* Copy all valid entries */
-    for (int i = 0; i < table->capacity; i++) {
-        Entry currentEntry = table->entries[i];
-        // Discard all non tombstone entries
-        // Only copy real entries 
-        if (currentEntry.key != NULL) {
-            Entry* entry = probeEntrySlot(entries, capacity, currentEntry.key);
-            entry->key = currentEntry.key;
-            entry->value = currentEntry.value;
-            table->count++;
+    return mask;
+#endif
+}
+
+static inline uint32_t matchFree(const uint8_t* group) {
+    /* Bitmask of the empty or deleted slots in the group */
+#ifdef TABLE_SSE2
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < GROUP_WIDTH; i++) {
+        if (group[i] & 0x80) mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+static inline uint32_t groupMask(int capacity) {
+    return capacity >= GROUP_WIDTH ? (1u << GROUP_WIDTH) - 1 : (1u << capacity) - 1;
+}
+
+static inline uint32_t lastGroup(int capacity) {
+    /* Groups are a power of 2 too, so this doubles as the mask for group numbers */
+    return capacity >= GROUP_WIDTH ? (uint32_t)(capacity / GROUP_WIDTH) - 1 : 0;
+}
+
+static inline size_t ctrlSize(int capacity) {
+    /* Even a partial group gets loaded whole */
+    return capacity >= GROUP_WIDTH ? (size_t)capacity : GROUP_WIDTH;
+}
+
+static uint8_t* allocateCtrl(int capacity) {
+    uint8_t* ctrl = ALLOCATE_ARRAY(MEMORY_TABLES, uint8_t, ctrlSize(capacity));
+    memset(ctrl, CTRL_EMPTY, ctrlSize(capacity));
+    return ctrl;
+}
+
+static uint32_t findFreeSlot(uint8_t* ctrl, int capacity, uint32_t hash) {
+    /* Returns the first empty or deleted slot on the key's probe sequence,
+     * groups are visited in triangular steps which reach every group */
+    uint32_t groups = lastGroup(capacity);
+    uint32_t group = H1(hash) & groups;
+
+    for (uint32_t step = 1;; step++) {
+        uint32_t free = matchFree(&ctrl[group * GROUP_WIDTH]) & groupMask(capacity);
+        if (free != 0) return group * GROUP_WIDTH + __builtin_ctz(free);
+
+        group = (group + step) & groups;
+    }
+}
+
+/* Hash part layout
+ *
+ * The hash part of a Table is split in two, the probed slots and a dense vector of
+ * entries kept in insertion order. Slots hold positions in the entry vector,
+ * stored in 8, 16 or 32 bit integers depending on how many entries the table can
+ * hold, so small tables stay small. Iteration and marking only walk the entry vector,
+ * deleted entries are left in place with a nil key until the next resize */
+
+static inline size_t indexWidth(int capacity) {
+    if (TABLE_USABLE(capacity) <= UINT8_MAX) return sizeof(uint8_t);
+    if (TABLE_USABLE(capacity) <= UINT16_MAX) return sizeof(uint16_t);
+    return sizeof(uint32_t);
+}
+
+static inline int readIndex(void* index, int capacity, uint32_t slot) {
+    switch (indexWidth(capacity)) {
+        case sizeof(uint8_t): return ((uint8_t*)index)[slot];
+        case sizeof(uint16_t): return ((uint16_t*)index)[slot];
+        default: return (int)((uint32_t*)index)[slot];
+    }
+}
+
+static inline void writeIndex(void* index, int capacity, uint32_t slot, int position) {
+    switch (indexWidth(capacity)) {
+        case sizeof(uint8_t): ((uint8_t*)index)[slot] = (uint8_t)position; break;
+        case sizeof(uint16_t): ((uint16_t*)index)[slot] = (uint16_t)position; break;
+        default: ((uint32_t*)index)[slot] = (uint32_t)position; break;
+    }
+}
+
+static int findSlot(Table* table, Value key, uint32_t hash) {
+    /* Returns the slot holding the key, or -1 if it isn't in the hash part */
+    if (table->count == 0) return -1;
+
+    uint32_t groups = lastGroup(table->capacity);
+    uint32_t valid = groupMask(table->capacity);
+    uint32_t group = H1(hash) & groups;
+    uint8_t fragment = H2(hash);
+
+    for (uint32_t step = 1;; step++) {
+        uint8_t* ctrl = &table->ctrl[group * GROUP_WIDTH];
+        uint32_t match = matchByte(ctrl, fragment) & valid;
+
+        while (match != 0) {
+            uint32_t slot = group * GROUP_WIDTH + __builtin_ctz(match);
+            Entry* entry = &table->entries[readIndex(table->index, table->capacity, slot)];
+
+            if (keysEqual(entry->key, key)) return (int)slot;
+            match &= match - 1;
         }
+
+        if ((matchByte(ctrl, CTRL_EMPTY) & valid) != 0) return -1;
+        group = (group + step) & groups;
     }
+}
+
+static int findPtrSlot(PtrTable* table, ObjString* key) {
+    if (table->count == 0) return -1;
+
+    uint32_t groups = lastGroup(table->capacity);
+    uint32_t valid = groupMask(table->capacity);
+    uint32_t group = H1(key->obj.hash) & groups;
+    uint8_t fragment = H2(key->obj.hash);
+
+    for (uint32_t step = 1;; step++) {
+        uint8_t* ctrl = &table->ctrl[group * GROUP_WIDTH];
+        uint32_t match = matchByte(ctrl, fragment) & valid;
 
+        while (match != 0) {
+            uint32_t slot = group * GROUP_WIDTH + __builtin_ctz(match);
+            /* NOTE : We can compare 2 keys directly because strings are interned */
+            if (table->entries[slot].key == key) return (int)slot;
+            match &= match - 1;
+        }
+
+        if ((matchByte(ctrl, CTRL_EMPTY) & valid) != 0) return -1;
+        group = (group + step) & groups;
+    }
+}
+
+
+
+static void adjustCapacity(Table* table, int capacity) {
+    /* Slots are positioned relative to the older capacity, so the slots are
+     * rebuilt from scratch, the live entries get packed together in their old order */
+    uint8_t* ctrl = allocateCtrl(capacity);
+    void* index = ALLOCATE_ARRAY(MEMORY_TABLES, uint8_t, indexWidth(capacity) * capacity);
+    Entry* entries = ALLOCATE_ARRAY(MEMORY_TABLES, Entry, TABLE_USABLE(capacity));
+    int count = 0;
+
+    for (int i = 0; i < table->entryCount; i++) {
+        Entry* entry = &table->entries[i];
+        if (CHECK_NIL(entry->key)) continue;
+
+        /* Keys are unique, so we only need a free slot */
+        uint32_t hash = hashValue(entry->key);
+        uint32_t slot = findFreeSlot(ctrl, capacity, hash);
+
+        ctrl[slot] = H2(hash);
+        writeIndex(index, capacity, slot, count);
+        entries[count++] = *entry;
+    }
+
+    FREE_ARRAY(MEMORY_TABLES, Entry, table->entries, TABLE_USABLE(table->capacity));
+    FREE_ARRAY(MEMORY_TABLES, uint8_t, table->index, indexWidth(table->capacity) * table->capacity);
+    FREE_ARRAY(MEMORY_TABLES, uint8_t, table->ctrl, ctrlSize(table->capacity));
+
+    table->ctrl = ctrl;
+    table->index = index;
     table->entries = entries;
     table->capacity = capacity;
+    table->count = count;
+    table->entryCount = count;
 }
 
 static void adjustMethodTableCapacity(PtrTable* table, int capacity) {
-    /* The entries are positioned relative to the older capacity, to make sure 
+    /* The entries are positioned relative to the older capacity, to make sure
      * the probe sequence remains problem free and returns the current result
-     * after changing the capacity, they have to be reinserted completely */  
-    PtrEntry* entries = ALLOCATE_ARRAY(PtrEntry, capacity);
-    table->count = 0;
-    /* Reset all slots back to NULL */ 
+     * after changing the capacity, they have to be reinserted completely */
+    uint8_t* ctrl = allocateCtrl(capacity);
+    PtrEntry* entries = ALLOCATE_ARRAY(MEMORY_TABLES, PtrEntry, capacity);
+    /* Reset all slots back to NULL */
     for (int i = 0; i < capacity; i++) {
         entries[i].key = NULL;
         entries[i].value = NULL;
-        entries[i].tombstone = false;
     }
-    
+
     /* Copy all valid entries */
     for (int i = 0; i < table->capacity; i++) {
-        PtrEntry currentEntry = table->entries[i];
-        // Discard all non tombstone entries
-        // Only copy real entries 
-        if (currentEntry.key != NULL) {
-            PtrEntry* entry = probePtrEntrySlot(entries, capacity, currentEntry.key);
-            entry->key = currentEntry.key;
-            entry->value = currentEntry.value;
-            entry->tombstone = false;
-            table->count++;
+        PtrEntry* currentEntry = &table->entries[i];
+
+        if (currentEntry->key != NULL) {
+            uint32_t slot = findFreeSlot(ctrl, capacity, currentEntry->key->obj.hash);
+            ctrl[slot] = H2(currentEntry->key->obj.hash);
+            entries[slot] = *currentEntry;
         }
     }
 
+    FREE_ARRAY(MEMORY_TABLES, PtrEntry, table->entries, table->capacity);
+    FREE_ARRAY(MEMORY_TABLES, uint8_t, table->ctrl, ctrlSize(table->capacity));
+
+    table->ctrl = ctrl;
     table->entries = entries;
     table->capacity = capacity;
 }
 
 
 
-bool insertTable(Table* table, ObjString* key, Value value) {
-    if (table->count + 1 > table->capacity * MAX_LOAD_FACTOR) {
-        int capacity = GROW_CAPACITY(table->capacity);
-        adjustCapacity(table, capacity);
+static int capacityFor(int count) {
+    /* Smallest capacity which leaves the table at most half full with 'count' entries, 
+     * sizing off the live entries means resizing a table full of tombstones 
+     * rehashes it in place, or shrinks it, instead of growing it */
+    int capacity = THRESHOLD;
+    while (TABLE_USABLE(capacity) < count * 2) capacity *= 2;
+    return capacity;
+}
+
+static bool insertHash(Table* table, Value key, uint32_t hash, Value value) {
+    int found = findSlot(table, key, hash);
+
+    if (found != -1) {
+        table->entries[readIndex(table->index, table->capacity, found)].value = value;
+        return false;
+    }
+
+    if (table->entryCount + 1 > TABLE_USABLE(table->capacity)) {
+        adjustCapacity(table, capacityFor(table->count + 1));
     }
-    
-    
-    Entry* entry = probeEntrySlot(table->entries, table->capacity, key);
-    bool isNewEntry = entry->key == NULL;
-    Value oldValue = entry->value;
+
+    /* New keys are appended to the entries */
+    uint32_t slot = findFreeSlot(table->ctrl, table->capacity, hash);
+    Entry* entry = &table->entries[table->entryCount];
     entry->key = key;
     entry->value = value;
-    if (isNewEntry && CHECK_NIL(oldValue)) table->count++;
-    return isNewEntry;
+    table->ctrl[slot] = H2(hash);
+    writeIndex(table->index, table->capacity, slot, table->entryCount);
+    table->entryCount++;
+    table->count++;
+    return true;
+}
+
+static void removeSlot(Table* table, int slot) {
+    /* The deleted control byte keeps probe sequences going, the entry is left as a hole */
+    Entry* entry = &table->entries[readIndex(table->index, table->capacity, slot)];
+
+    table->ctrl[slot] = CTRL_DELETED;
+    entry->key = NIL();
+    entry->value = NIL();
+    table->count--;
+}
+
+static void migrateToArray(Table* table) {
+    /* After the array part grows, the keys continuing the sequence
+     * might still be in the hash part, they are moved over */
+    while (table->count != 0) {
+        Value key = NATIVE_TO_NUMBER((double)table->array.count);
+        int slot = findSlot(table, key, hashValue(key));
+
+        if (slot == -1) return;
+
+        Value value = table->entries[readIndex(table->index, table->capacity, slot)].value;
+        removeSlot(table, slot);
+        writeValueArray(&table->array, value);
+    }
+}
+
+bool insertTable(Table* table, ObjString* key, Value value) {
+    return insertHash(table, OBJ(key), key->obj.hash, value);
 }
 
+static bool deleteHash(Table* table, Value key, uint32_t hash);
+
+bool insertValueTable(Table* table, Value key, Value value) {
+    /* Storing nil removes the key, in the array part as well as in the hash part */
+    int slot = arraySlot(key);
+
+    if (slot != -1 && slot < table->array.count) {
+        bool isNewEntry = CHECK_NIL(table->array.values[slot]) && !CHECK_NIL(value);
+        table->array.values[slot] = value;
+        return isNewEntry;
+    }
+
+    if (CHECK_NIL(value)) {
+        deleteHash(table, key, hashValue(key));
+        return false;
+    }
+
+    if (slot != -1 && slot == table->array.count) {
+        writeValueArray(&table->array, value);
+        migrateToArray(table);
+        return true;
+    }
+
+    return insertHash(table, key, hashValue(key), value);
+}
 
 bool insertPtrTable(PtrTable* table, ObjString* key, void* value) {
+    int found = findPtrSlot(table, key);
+
+    if (found != -1) {
+        table->entries[found].value = value;
+        return false;
+    }
+
     if (table->count + 1 > table->capacity * MAX_LOAD_FACTOR) {
         int capacity = GROW_CAPACITY(table->capacity);
         adjustMethodTableCapacity(table, capacity);
     }
-    
-    
-    PtrEntry* entry = probePtrEntrySlot(table->entries, table->capacity, key);
-    bool isNewEntry = entry->key == NULL;
-    NativeMethodPtr oldValue = entry->value;
-    entry->key = key;
-    entry->value = value;
-    entry->tombstone = false;
 
-    if (isNewEntry && oldValue == NULL) table->count++;
-    return isNewEntry;
+    uint32_t slot = findFreeSlot(table->ctrl, table->capacity, key->obj.hash);
+    table->ctrl[slot] = H2(key->obj.hash);
+    table->entries[slot].key = key;
+    table->entries[slot].value = value;
+    table->count++;
+    return true;
 }
 
 
 
-bool getTable(Table* table, ObjString* key, Value* value) {
-    if (table->count == 0) return false;
-    Entry* entry = probeEntrySlot(table->entries, table->capacity, key);
-    
-    if (entry->key == NULL) { 
+static bool getHash(Table* table, Value key, uint32_t hash, Value* value) {
+    int slot = findSlot(table, key, hash);
+
+    if (slot == -1) {
         return false;
     }
-    *value = entry->value;
+    *value = table->entries[readIndex(table->index, table->capacity, slot)].value;
     return true;
 }
 
+bool getTable(Table* table, ObjString* key, Value* value) {
+    return getHash(table, OBJ(key), key->obj.hash, value);
+}
+
+bool getValueTable(Table* table, Value key, Value* value) {
+    int slot = arraySlot(key);
+
+    /* Integer keys below the array part's length never live in the hash part */
+    if (slot != -1 && slot < table->array.count) {
+        if (CHECK_NIL(table->array.values[slot])) return false;
+
+        *value = table->array.values[slot];
+        return true;
+    }
+
+    return getHash(table, key, hashValue(key), value);
+}
+
 bool getPtrTable(PtrTable* table, ObjString* key, void** value) {
-    if (table->count == 0) return false;
-    PtrEntry* entry = probePtrEntrySlot(table->entries, table->capacity, key);
-    
-    if (entry->key == NULL) { 
+    int slot = findPtrSlot(table, key);
+
+    if (slot == -1) {
         return false;
     }
-    *value = entry->value;
+    *value = table->entries[slot].value;
     return true;
 }
 
 
 
 void copyTableAll(Table* from, Table* to) {
-    for (int i = 0 ; i < from->capacity; i++) {
+    for (int i = 0; i < from->array.count; i++) {
+        if (!CHECK_NIL(from->array.values[i])) {
+            insertValueTable(to, NATIVE_TO_NUMBER((double)i), from->array.values[i]);
+        }
+    }
+
+    for (int i = 0; i < from->entryCount; i++) {
         Entry* entry = &from->entries[i];
-        if (entry->key != NULL) {
-            insertTable(to, entry->key, entry->value);
+        if (!CHECK_NIL(entry->key)) {
+            insertValueTable(to, entry->key, entry->value);
         }
     }
 }
@@ -212,38 +484,100 @@ void copyTableAll(Table* from, Table* to) {
 
 ObjString* findStringTable(Table* table, char* chars, int length, uint32_t hash) {
     if (table->count == 0) return NULL;
-    uint32_t index = hash & (table->capacity - 1);
-    for (;;) {
-        Entry* entry = &table->entries[index];
-        if (entry->key == NULL) {
-            if (CHECK_NIL(entry->value)) {
-                return NULL;
+
+    uint32_t groups = lastGroup(table->capacity);
+    uint32_t valid = groupMask(table->capacity);
+    uint32_t group = H1(hash) & groups;
+    uint8_t fragment = H2(hash);
+
+    for (uint32_t step = 1;; step++) {
+        uint8_t* ctrl = &table->ctrl[group * GROUP_WIDTH];
+        uint32_t match = matchByte(ctrl, fragment) & valid;
+
+        while (match != 0) {
+            uint32_t slot = group * GROUP_WIDTH + __builtin_ctz(match);
+            /* The interning table only ever holds strings */
+            ObjString* key = AS_STRING(table->entries[readIndex(table->index, table->capacity, slot)].key);
+
+            if (key->length == length && key->obj.hash == hash &&
+                    memcmp(&key->allocated, chars, length) == 0) {
+                return key;
             }
-        } else if (entry->key->length == length && 
-                   entry->key->obj.hash == hash &&
-                   memcmp(&entry->key->allocated, chars, length) == 0) {
-            return entry->key;
+            match &= match - 1;
         }
-        index = (index + 1) & (table->capacity - 1);    
+
+        if ((matchByte(ctrl, CTRL_EMPTY) & valid) != 0) return NULL;
+        group = (group + step) & groups;
     }
 
 }
 
+static bool deleteHash(Table* table, Value key, uint32_t hash) {
+    int slot = findSlot(table, key, hash);
+    if (slot == -1) return false;
+
+    removeSlot(table, slot);
+    return true;
+}
+
 bool deleteTable(Table* table, ObjString* key) {
-    if (table->count == 0) return false;
+    return deleteHash(table, OBJ(key), key->obj.hash);
+}
 
-    Entry* entry = probeEntrySlot(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
+bool deleteValueTable(Table* table, Value key) {
+    int slot = arraySlot(key);
 
-    /* Place a tombstone */ 
-    entry->key = NULL;
-    entry->value = NATIVE_TO_BOOLEAN(false);
+    if (slot != -1 && slot < table->array.count) {
+        bool existed = !CHECK_NIL(table->array.values[slot]);
+        table->array.values[slot] = NIL();
+        return existed;
+    }
 
-    return true;
+    return deleteHash(table, key, hashValue(key));
+}
+
+void compactTable(Table* table) {
+    /* Deleting never resizes, so that entries can be deleted while the table is 
+     * being iterated, this gets called afterwards instead. Tables where tombstones 
+     * make up a large part of the entries get rehashed in place, and tables which 
+     * have become mostly empty are shrunk */
+    if (table->count == 0 && table->array.count == 0) {
+        freeTable(table);
+        return;
+    }
+
+    int usable = TABLE_USABLE(table->capacity);
+    bool tooManyTombstones = TABLE_TOMBSTONES(table) > usable / 4;
+    bool tooSparse = table->capacity > THRESHOLD && table->count < usable / 4;
+
+    if (tooManyTombstones || tooSparse) {
+        if (table->count == 0) {
+            FREE_ARRAY(MEMORY_TABLES, Entry, table->entries, usable);
+            FREE_ARRAY(MEMORY_TABLES, uint8_t, table->index, indexWidth(table->capacity) * table->capacity);
+            FREE_ARRAY(MEMORY_TABLES, uint8_t, table->ctrl, ctrlSize(table->capacity));
+            table->capacity = 0;
+            table->entryCount = 0;
+            table->ctrl = NULL;
+            table->index = NULL;
+            table->entries = NULL;
+        } else {
+            adjustCapacity(table, capacityFor(table->count));
+        }
+    }
+
+    /* Absent keys at the end of the array part can be dropped */
+    ValueArray* array = &table->array;
+    while (array->count > 0 && CHECK_NIL(array->values[array->count - 1])) array->count--;
+
+    if (array->capacity > THRESHOLD && array->count < array->capacity / 4) {
+        int capacity = array->count < THRESHOLD ? THRESHOLD : array->count;
+        array->values = GROW_ARRAY(MEMORY_ARRAYS, Value, array->values, array->capacity, capacity);
+        array->capacity = capacity;
+    }
 }
 
 uint32_t hash_string(const char* string, int length) {
-    uint32_t hash;
+    uint32_t hash = 2166136261u;
 
     for (int i = 0; i < length; i++) {
         hash ^= (uint8_t)string[i];
@@ -254,11 +588,23 @@ uint32_t hash_string(const char* string, int length) {
 }
 
 void freeTable(Table* table) {
-    FREE_ARRAY(Entry, table->entries, table->capacity);    /* Free the array */
+    FREE_ARRAY(MEMORY_TABLES, Entry, table->entries, TABLE_USABLE(table->capacity));
+    FREE_ARRAY(MEMORY_TABLES, uint8_t, table->index, indexWidth(table->capacity) * table->capacity);
+    FREE_ARRAY(MEMORY_TABLES, uint8_t, table->ctrl, ctrlSize(table->capacity));
+    freeValueArray(&table->array);
     initTable(table);                                      /* Reset */
 }
 
+size_t tableMemory(Table* table) {
+    size_t bytes = table->array.capacity * sizeof(Value);
+    if (table->capacity == 0) return bytes;
+
+    return bytes + TABLE_USABLE(table->capacity) * sizeof(Entry) 
+        + indexWidth(table->capacity) * table->capacity + ctrlSize(table->capacity);
+}
+
 void freePtrTable(PtrTable* table) {
-    FREE_ARRAY(PtrEntry, table->entries, table->capacity);
+    FREE_ARRAY(MEMORY_TABLES, PtrEntry, table->entries, table->capacity);
+    FREE_ARRAY(MEMORY_TABLES, uint8_t, table->ctrl, ctrlSize(table->capacity));
     initPtrTable(table);
 }
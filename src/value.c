@@ -13,7 +13,7 @@ void writeValueArray(ValueArray* array, Value value) {
     if (array->capacity < array->count + 1) {
         int oldCapacity = array->capacity;
         array->capacity = GROW_CAPACITY(oldCapacity);
-        array->values = GROW_ARRAY(Value, array->values, oldCapacity, array->capacity);
+        array->values = GROW_ARRAY(MEMORY_ARRAYS, Value, array->values, oldCapacity, array->capacity);
     }
 
 
@@ -22,7 +22,7 @@ void writeValueArray(ValueArray* array, Value value) {
 }
 
 void freeValueArray(ValueArray* array) {
-    FREE_ARRAY(Value, array->values, array->capacity);
+    FREE_ARRAY(MEMORY_ARRAYS, Value, array->values, array->capacity);
     initValueArray(array);
 }
 
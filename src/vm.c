@@ -9,6 +9,13 @@
 #include "../includes/memory.h"
 #include "../includes/compiler.h"
 #include "../includes/msapi.h"
+#include "../includes/gcollect.h"
+#include "../includes/gcmark.h"
+#include "../includes/finalize.h"
+#include "../includes/heapprof.h"
+#include "../includes/bytecache.h"
+#include "../includes/modules.h"
+#include "../includes/precompile.h"
 
 #include <math.h>
 #include <stdarg.h>
@@ -73,9 +80,16 @@
                           
 
 static void injectArrayMethods(VM* vm) {
-    ObjString* string = allocateString(vm, "insert", 6);
-
-    insertPtrTable(&vm->arrayMethods, string, &msmethod_array_insert);
+    insertPtrTable(&vm->arrayMethods, allocateString(vm, "insert", 6), &msmethod_array_insert);
+    insertPtrTable(&vm->arrayMethods, allocateString(vm, "pop", 3), &msmethod_array_pop);
+    insertPtrTable(&vm->arrayMethods, allocateString(vm, "remove", 6), &msmethod_array_remove);
+    insertPtrTable(&vm->arrayMethods, allocateString(vm, "indexOf", 7), &msmethod_array_indexOf);
+    insertPtrTable(&vm->arrayMethods, allocateString(vm, "slice", 5), &msmethod_array_slice);
+    insertPtrTable(&vm->arrayMethods, allocateString(vm, "reserve", 7), &msmethod_array_reserve);
+    insertPtrTable(&vm->arrayMethods, allocateString(vm, "sort", 4), &msmethod_array_sort);
+    insertPtrTable(&vm->arrayMethods, allocateString(vm, "map", 3), &msmethod_array_map);
+    insertPtrTable(&vm->arrayMethods, allocateString(vm, "filter", 6), &msmethod_array_filter);
+    insertPtrTable(&vm->arrayMethods, allocateString(vm, "reduce", 6), &msmethod_array_reduce);
 }
 
 static void injectStringMethods(VM* vm) {
@@ -102,14 +116,95 @@ static void injectDllMethods(VM* vm) {
     insertPtrTable(&vm->dllMethods, closeString, &msmethod_dll_close);
 }
 
+static void parseSearchPaths(VM* vm) {
+    /* MEGPATH is read once, it holds any number of directories 
+     * separated like in PATH */ 
+    vm->searchPaths = NULL;
+    vm->searchPathCount = 0;
+
+    char* var = getenv("MEGPATH");
+    if (var == NULL) return;
+
+    int count = 1;
+    for (char* c = var; *c != '\0'; c++) {
+        if (*c == MEGPATH_SEPARATOR) count++;
+    }
+
+    vm->searchPaths = ALLOCATE_ARRAY(MEMORY_OTHER, char*, count);
+
+    for (char* start = var;; ) {
+        char* end = strchr(start, MEGPATH_SEPARATOR);
+        size_t length = end != NULL ? (size_t)(end - start) : strlen(start);
+
+        /* Empty entries are skipped, the current directory is always searched first */ 
+        if (length > 0) {
+            char* directory = ALLOCATE_ARRAY(MEMORY_OTHER, char, length + 1);
+            memcpy(directory, start, length);
+            directory[length] = '\0';
+            vm->searchPaths[vm->searchPathCount++] = directory;
+        }
+
+        if (end == NULL) break;
+        start = end + 1;
+    }
+
+    vm->searchPaths = GROW_ARRAY(MEMORY_OTHER, char*, vm->searchPaths, count, vm->searchPathCount);
+}
+
+static void freeSearchPaths(VM* vm) {
+    for (int i = 0; i < vm->searchPathCount; i++) {
+        FREE_ARRAY(MEMORY_OTHER, char, vm->searchPaths[i], strlen(vm->searchPaths[i]) + 1);
+    }
+
+    FREE_ARRAY(MEMORY_OTHER, char*, vm->searchPaths, vm->searchPathCount);
+    vm->searchPaths = NULL;
+    vm->searchPathCount = 0;
+}
+
 void initVM(VM* vm) {
+    for (int i = 0; i < MEMORY_CATEGORIES; i++) vm->memory[i] = 0;
+    setAccountingVM(vm);
+    initPool(&vm->objects);
+    initPool(&vm->blocks);
+    vm->objects.sweeper = gcSweepPage;
+    vm->objects.sweeperData = vm;
     vm->frameCount = 0;
-    vm->ObjHead = NULL;
+    vm->callBoundary = 0;
     vm->greyCount = 0;
     vm->greyCapacity = 0;
     vm->greyStack = NULL;
+    vm->remembered = NULL;
+    vm->rememberedCount = 0;
+    vm->rememberedCapacity = 0;
     vm->bytesAllocated = 0;
-    vm->nextGC = 1024 * 1024;
+    vm->gcGrowFactor = GC_HEAP_GROW_FACTOR;
+    vm->gcMinHeap = GC_MIN_HEAP;
+    vm->gcMaxHeap = GC_MAX_HEAP;
+    vm->gcEnabled = true;
+    vm->gcCollections = 0;
+    vm->gcFullCollections = 0;
+    vm->nextGC = GC_MIN_HEAP;
+    vm->nextFullGC = GC_MIN_HEAP * GC_HEAP_GROW_FACTOR;
+    vm->minorGC = false;
+    #ifdef GC_INCREMENTAL
+        vm->gcMode = GC_MODE_INCREMENTAL;
+    #else
+        vm->gcMode = GC_MODE_GENERATIONAL;
+    #endif
+    vm->gcPhase = GC_PHASE_PAUSE;
+    vm->sweepPage = NULL;
+    vm->gcStepSize = GC_STEP_SIZE;
+    vm->gcStepUnits = GC_STEP_UNITS;
+    vm->gcStepMicros = GC_STEP_MICROS;
+    vm->gcMarkThreads = 1;
+    vm->marker = NULL;
+    vm->weakTables = NULL;
+    vm->finalizers = NULL;
+    vm->finalizerCount = 0;
+    vm->finalizerCapacity = 0;
+    vm->gcFinalized = 0;
+    vm->profiler = NULL;
+    gcReadEnvironment(vm);
     initTable(&vm->strings);
     initPtrTable(&vm->arrayMethods);
     initPtrTable(&vm->stringMethods);
@@ -118,9 +213,15 @@ void initVM(VM* vm) {
 
     resetStack(vm);
     vm->running = false;
+    vm->silentErrors = false;
     initTable(&vm->importCache);
+    initTable(&vm->resolvedImports);
+    parseSearchPaths(vm);
     vm->moduleCount = 0;
     vm->currentModule = NULL; 
+    vm->precompiled = NULL;
+    vm->precompiledCount = 0;
+    vm->precompiledCapacity = 0;
 
     injectArrayMethods(vm);
     injectStringMethods(vm);
@@ -132,16 +233,24 @@ void initVM(VM* vm) {
 }
 
 void freeVM(VM* vm) {
+    freeMarker(vm);
+    stopProfiler(vm);
     freeTable(&vm->strings);
-    freeObject(vm, &vm->globals->obj);
-    freeTable(&vm->importCache);
     freePtrTable(&vm->arrayMethods);
     freePtrTable(&vm->stringMethods);
     freePtrTable(&vm->tableMethods);
     freePtrTable(&vm->dllMethods);
     freeTable(&vm->importCache);
+    freeTable(&vm->resolvedImports);
+    freeSearchPaths(vm);
+    freePrecompiled(vm);
     freeObjects(vm);
-    FREE_ARRAY(Obj*, vm->greyStack, vm->greyCapacity);
+    runFinalizers(vm);
+    FREE_ARRAY(MEMORY_COLLECTOR, Obj*, vm->greyStack, vm->greyCapacity);
+    FREE_ARRAY(MEMORY_COLLECTOR, Obj*, vm->remembered, vm->rememberedCapacity);
+    freePool(&vm->objects);
+    freePool(&vm->blocks);
+    setAccountingVM(NULL);
 }
 
 void resetStack(VM* vm) {
@@ -161,7 +270,7 @@ void writeObjStringArray(ObjStringArray* array, ObjString* value) {
     if (array->capacity < array->count + 1) {
         int oldCapacity = array->capacity;
         array->capacity = GROW_CAPACITY(oldCapacity);
-        array->values = GROW_ARRAY(ObjString*, array->values, oldCapacity, array->capacity);
+        array->values = GROW_ARRAY(MEMORY_OTHER, ObjString*, array->values, oldCapacity, array->capacity);
     }
 
 
@@ -170,7 +279,7 @@ void writeObjStringArray(ObjStringArray* array, ObjString* value) {
 }
 
 void freeObjStringArray(ObjStringArray* array) {
-    FREE_ARRAY(ObjString*, array->values, array->capacity);
+    FREE_ARRAY(MEMORY_OTHER, ObjString*, array->values, array->capacity);
     initObjStringArray(array);
 }
 
@@ -187,7 +296,7 @@ void msapi_runtimeError(VM* vm, const char* format, ...) {
     
     CallFrame* frame = &vm->frames[vm->frameCount - 1];
     size_t ins = frame->ip - frame->closure->function->chunk.code - 1;
-    int line = frame->closure->function->chunk.lines[ins];
+    int line = getLine(&frame->closure->function->chunk, (int)ins);
     fprintf(stderr, "Line %d: ", line);
     fprintf(stderr, "In Script\n");
 
@@ -234,6 +343,11 @@ static inline Value* peekptr(VM* vm, int offset) {
     return &vm->stackTop[-1 - offset];
 }
 
+static inline void setGlobal(VM* vm, ObjString* name, Value value) {
+    insertTable(&vm->globals->table, name, value);
+    gcWriteBarrierEntry(vm, &vm->globals->obj, OBJ(name), value);
+}
+
 static inline bool isFalsey(Value value) {
     return CHECK_NIL(value) || (CHECK_BOOLEAN(value) && !AS_BOOL(value));
 }
@@ -370,6 +484,13 @@ static bool call(VM* vm, Value value, bool shouldReturn, int argCount) {
         case OBJ_NATIVE_METHOD: {
             ObjNativeMethod* native = AS_NATIVE_METHOD(value);
             NativeMethodPtr ptr = native->function;
+
+            if (argCount < native->arity) {
+                msapi_runtimeError(vm, "Expected at least %d arguments to '%s', got %d", 
+                        native->arity, native->name->allocated, argCount);
+                return false;
+            }
+
             bool result = (*ptr)(vm, native->self, argCount, shouldReturn);
             if (!result) return false;
             break;
@@ -377,9 +498,11 @@ static bool call(VM* vm, Value value, bool shouldReturn, int argCount) {
         case OBJ_CLASS: {
             ObjClass* klass = AS_CLASS(value);
             ObjInstance* instance = allocateInstance(vm, klass); 
+            /* The instance takes the place of the class (as self) right away, 
+             * so it stays reachable while the initializer is looked up */
+            vm->stackTop[-argCount - 1] = OBJ(instance);
             Value _init;
             if (getTable(&klass->methods, allocateString(vm, "_init", 5), &_init)) {
-                vm->stackTop[-argCount - 1] = OBJ(instance);        // set self
                 return callClosure(vm, AS_CLOSURE(_init), true, argCount, false);
             }
             
@@ -415,51 +538,111 @@ bool msapi_callClosure(VM* vm, ObjClosure* closure, bool shouldReturn, int argCo
     return callClosure(vm, closure, shouldReturn, argCount, isCoroutine);
 }
 
+static InterpretResult run(VM* vm, int exitFrame);
+
+bool msapi_call(VM* vm, int argCount) {
+    /* Calls the value below the arguments and runs it to completion before returning, 
+     * the return value is left on top of the stack in place of the callee and arguments. 
+     * This lets natives call back into scripts, the dispatch loop is re-entered and exits 
+     * as soon as the frame it was started for returns */
+    int frameCount = vm->frameCount;
+
+    if (!callValue(vm, peek(vm, argCount), true, argCount)) return false;
+    /* Natives and classes without an initializer finish immediately */
+    if (vm->frameCount == frameCount) return true;
+
+    int boundary = vm->callBoundary;
+    vm->callBoundary = frameCount;
+    InterpretResult result = run(vm, frameCount);
+    vm->callBoundary = boundary;
+
+    return result == INTERPRET_OK;
+}
+
 char* findFile(VM* vm, char* path, bool genErr) {
-    /* This function searches for the file in all supported ways */ 
-   
-    if (access(path, F_OK) == -1) {
-        /* Not in current directory */ 
-        char* var = getenv("MEGPATH");
-        if (var != NULL) {
-            /* User has set env variable */ 
-            int length = strlen(var) + strlen(path) + 2;
-            char* chars = (char*)reallocate(vm, NULL, 0, sizeof(char) * length);
-            strcpy(chars, var);
-            strcat(chars, "/");
-            strcat(chars, path); 
-            chars[length] = '\0';
-            
-            if (access(chars, F_OK) != -1) {
-                /* We found it bois */
-                return chars;
-            }
-        }
+    /* This function searches for the file in all supported ways, the 
+     * current directory first and then every directory of MEGPATH */ 
+    size_t pathLength = strlen(path);
 
-        if (genErr) msapi_runtimeError(vm, "Unable to locate file : %s", path);
-        return NULL;
-    } else {
-        int length = strlen(path);
-        char* chars = (char*)reallocate(vm, NULL, 0, sizeof(char) * length);
-        chars[length] = '\0';
-        strcpy(chars, path);
+    if (access(path, F_OK) != -1) {
+        char* chars = (char*)reallocate(vm, NULL, 0, pathLength + 1);
+        memcpy(chars, path, pathLength + 1);
         return chars;
     }
+
+    for (int i = 0; i < vm->searchPathCount; i++) {
+        size_t directoryLength = strlen(vm->searchPaths[i]);
+        char candidate[directoryLength + pathLength + 2];
+
+        memcpy(candidate, vm->searchPaths[i], directoryLength);
+        candidate[directoryLength] = '/';
+        memcpy(candidate + directoryLength + 1, path, pathLength + 1);
+
+        if (access(candidate, F_OK) != -1) {
+            char* chars = (char*)reallocate(vm, NULL, 0, sizeof(candidate));
+            memcpy(chars, candidate, sizeof(candidate));
+            return chars;
+        }
+    }
+
+    if (genErr) msapi_runtimeError(vm, "Unable to locate file : %s", path);
+    return NULL;
+}
+
+static bool callModule(VM* vm, ObjFunction* function, ObjString* fileName, ObjString* path) {
+    /* Runs the top level function of a module which was just compiled or loaded,
+     * it is on top of the stack */ 
+    if (vm->moduleCount >= IMPORT_CYCLE_MAX) {
+        msapi_runtimeError(vm, "Import stack full (possible circular import)");
+        return false;
+    }
+    
+    /* We can now proceed to create a new module object for the vm */
+    Module module;
+    module.moduleName = fileName;
+    module.modulePath = path;
+    module.globals = allocateTable(vm);
+    initObjStringArray(&module.customGlobals);
+    
+    /* After initialization, we add it to the vm and update */
+    vm->modules[vm->moduleCount] = module;
+    vm->currentModule = &vm->modules[vm->moduleCount];
+    vm->moduleCount++;
+    vm->globals = vm->currentModule->globals;
+    
+    /* We inject globals into it */ 
+    injectGlobals(vm);
+    
+    /* Now we wrap it into a closure, with the latest global environment, 
+     * and pop the function we pushed earlier for garbge collection protection */
+    ObjClosure* closure = allocateClosure(vm, function, vm->globals);
+    pop(vm);
+    
+    /* We can finally attempt a call to the module */
+    push(vm, OBJ(closure));
+    return callClosure(vm, closure, false, 0, false);
 }
 
-static bool importScript(VM* vm, const char* path, ObjString* fileName) {
-    /* First we check for this file in the cache, 
+static bool importScript(VM* vm, ObjString* path, ObjString* fileName) {
+    /* fileName is on the stack until the function holds it. 
+     * First we check for this file in the cache, 
      * to make sure its not getting re-imported */
     Value cached = NIL();
 
-    if (getTable(&vm->importCache, fileName, &cached)) {
-        insertTable(&vm->globals->table, fileName, cached);
+    if (getTable(&vm->importCache, path, &cached)) {
+        setGlobal(vm, fileName, cached);
+        pop(vm);
         return true;
     }
 
     /* If this file is not in the cache, we start by reading the file contents */ 
-    FILE* file = fopen(path, "r");
+    FILE* file = fopen(path->allocated, "r");
     size_t fileLength = 0;
+
+    if (file == NULL) {
+        msapi_runtimeError(vm, "Could not open file : %s", path->allocated);
+        return false;
+    }
     
     /* We first move our cursor to the end of the file */
     fseek(file, 0, SEEK_END);
@@ -476,46 +659,72 @@ static bool importScript(VM* vm, const char* path, ObjString* fileName) {
     fclose(file);
 
     /* We can now allocate a function and begin compiling *
-     * We also push it to avoid the garbage collection of it */
+     * We also push it to avoid the garbage collection of it, 
+     * in place of the file name it now holds */
     ObjFunction* function = allocateFunction(vm, fileName, 0);
+    pop(vm);
     push(vm, OBJ(function));
 
     /* We change the state of the vm to 'not running' since we 
-     * will begin compiling the file */
+     * will begin compiling the file (or loading its bytecode cache) */
     vm->running = false;
-    InterpretResult compilationResult = compile(fileContent, vm, function, false);
+    InterpretResult compilationResult = INTERPRET_OK;
+
+    if (!loadPrecompiled(vm, path->allocated, function)) {
+        compilationResult = compileCached(vm, path->allocated, fileContent, fileLength, function, false);
+    }
+
     vm->running = true;
+    reallocate(vm, fileContent, fileLength + 1, 0);
 
     /* We have finished compiling, we check the result */
     if (compilationResult == INTERPRET_COMPILE_ERROR) return false;
-    if (vm->moduleCount >= IMPORT_CYCLE_MAX) {
-        msapi_runtimeError(vm, "Import stack full (possible circular import)");
-        return false;
+    return callModule(vm, function, fileName, path);
+}
+
+static bool importEmbedded(VM* vm, const EmbeddedModule* embedded, ObjString* path, ObjString* fileName) {
+    /* Same as importScript, but the bytecode is already in the executable */ 
+    Value cached = NIL();
+
+    if (getTable(&vm->importCache, path, &cached)) {
+        setGlobal(vm, fileName, cached);
+        pop(vm);
+        return true;
     }
-    
-    /* We can now proceed to create a new module object for the vm */
-    Module module;
-    module.moduleName = fileName;
-    module.globals = allocateTable(vm);
-    initObjStringArray(&module.customGlobals);
-    
-    /* After initialization, we add it to the vm and update */
-    vm->modules[vm->moduleCount] = module;
-    vm->currentModule = &vm->modules[vm->moduleCount];
-    vm->moduleCount++;
-    vm->globals = vm->currentModule->globals;
-    
-    /* We inject globals into it */ 
-    injectGlobals(vm);
-    
-    /* Now we wrap it into a closure, with the latest global environment, 
-     * and pop the function we pushed earlier for garbge collection protection */
-    ObjClosure* closure = allocateClosure(vm, function, vm->globals);
+
+    ObjFunction* function = allocateFunction(vm, fileName, 0);
     pop(vm);
-    
-    /* We can finally attempt a call to the module */
-    push(vm, OBJ(closure));
-    return callClosure(vm, closure, false, 0, false);
+    push(vm, OBJ(function));
+
+    vm->running = false;
+    bool loaded = loadEmbeddedModule(vm, embedded, function);
+    vm->running = true;
+
+    if (!loaded) {
+        msapi_runtimeError(vm, "Embedded module '%s' is corrupted", embedded->path);
+        return false;
+    }
+
+    return callModule(vm, function, fileName, path);
+}
+
+static void registerNatives(VM* vm, ObjDllContainer* container, const NativeModuleFunction* functions) {
+    /* Creates the natives of a module once, the container is on the stack */ 
+    ObjTable* natives = allocateTable(vm);
+    container->natives = natives;
+    gcWriteBarrier(vm, &container->obj, OBJ(natives));
+
+    for (const NativeModuleFunction* entry = functions; entry->name != NULL; entry++) {
+        push(vm, OBJ(allocateString(vm, entry->name, strlen(entry->name))));
+        ObjNativeMethod* native = allocateNativeMethod(vm, AS_STRING(peek(vm, 0)), 
+                &container->obj, entry->function);
+        native->arity = entry->arity;
+        push(vm, OBJ(native));
+
+        insertTable(&natives->table, AS_STRING(peek(vm, 1)), peek(vm, 0));
+        gcWriteBarrierEntry(vm, &natives->obj, peek(vm, 1), peek(vm, 0));
+        popn(vm, 2);
+    }
 }
 
 static bool importSharedLib(VM* vm, const char* path, ObjString* fileName) {
@@ -527,10 +736,76 @@ static bool importSharedLib(VM* vm, const char* path, ObjString* fileName) {
     }
 
     ObjDllContainer* container = allocateDllContainer(vm, fileName, fileHandle);
-    insertTable(&vm->globals->table, fileName, OBJ(container));
+    pop(vm);
+    push(vm, OBJ(container));
+
+    NativeModuleRegister registerModule = (NativeModuleRegister)dlsym(fileHandle, MS_REGISTER_SYMBOL);
+    if (registerModule != NULL) registerNatives(vm, container, registerModule());
+
+    setGlobal(vm, fileName, OBJ(container));
+    pop(vm);
+    return true;
+}
+
+static bool importBuiltin(VM* vm, const NativeModuleFunction* functions, ObjString* fileName) {
+    ObjDllContainer* container = allocateDllContainer(vm, fileName, NULL);
+    pop(vm);
+    push(vm, OBJ(container));
+    registerNatives(vm, container, functions);
+    setGlobal(vm, fileName, OBJ(container));
+    pop(vm);
     return true;
 }
 
+static ObjString* probeFile(VM* vm, char* path) {
+    char* found = findFile(vm, path, false);
+    if (found == NULL) return NULL;
+
+    ObjString* string = allocateString(vm, found, strlen(found));
+    reallocate(vm, found, strlen(found) + 1, 0);
+    return string;
+}
+
+ObjString* resolveImport(VM* vm, ObjString* importPath) {
+    /* Finds what an import string refers to, the first time it is imported. 
+     * Every candidate is probed once per import string, including the ones 
+     * which aren't found, the results are kept in resolvedImports. */ 
+    Value resolved;
+
+    if (getTable(&vm->resolvedImports, importPath, &resolved)) {
+        return CHECK_STRING(resolved) ? AS_STRING(resolved) : NULL;
+    }
+
+    int pathLen = importPath->length;
+    char buffer[pathLen + 5];
+    ObjString* path = NULL;
+
+    memcpy(buffer, importPath->allocated, pathLen);
+    memcpy(&buffer[pathLen], ".meg", 5);
+
+    /* The standard library is compiled into the executable */ 
+    if (findEmbeddedModule(buffer) != NULL) {
+        path = allocateString(vm, buffer, pathLen + 4);
+    } else {
+        path = probeFile(vm, buffer);
+    }
+
+    /* Native modules linked into the executable come before shared libraries */ 
+    if (path == NULL && findBuiltinModule(importPath->allocated) == NULL) {
+        memcpy(&buffer[pathLen], ".so", 4);
+        path = probeFile(vm, buffer);
+
+        if (path == NULL) {
+            memcpy(&buffer[pathLen], ".dll", 5);
+            path = probeFile(vm, buffer);
+        }
+    }
+
+    /* The table is a root, inserting never collects */ 
+    insertTable(&vm->resolvedImports, importPath, path != NULL ? OBJ(path) : NATIVE_TO_BOOLEAN(false));
+    return path;
+}
+
 static bool import(VM* vm, ObjString* importPath) {
     char* name = &importPath->allocated[0];
     int nameLength = 0;
@@ -545,39 +820,26 @@ static bool import(VM* vm, ObjString* importPath) {
         }
     }
     
-    int pathLen = strlen(importPath->allocated);
-    char buffer[pathLen + 5];
+    /* The file name stays on the stack until what is imported holds it,
+     * every import helper pops it */
     ObjString* fileName = allocateString(vm, name, nameLength);
-    char* foundFile = NULL;
-    char* pathEndPtr = &buffer[pathLen];
+    push(vm, OBJ(fileName));
+    ObjString* path = resolveImport(vm, importPath);
 
-    memcpy(buffer, importPath->allocated, importPath->length);
-    memcpy(pathEndPtr, ".meg\0", 5);
-    foundFile = findFile(vm, buffer, false);
-    
-    if (foundFile != NULL) {
-        bool result = importScript(vm, foundFile, fileName);
-        reallocate(vm, foundFile, sizeof(*foundFile), 0);
-        return result;
-    }
-    
-    memcpy(pathEndPtr, ".so\0", 4);
-    foundFile = findFile(vm, buffer, false);
+    if (path != NULL) {
+        const EmbeddedModule* embedded = findEmbeddedModule(path->allocated);
+        if (embedded != NULL) return importEmbedded(vm, embedded, path, fileName);
 
-    if (foundFile != NULL) {
-        bool result = importSharedLib(vm, foundFile, fileName);
-        reallocate(vm, foundFile, sizeof(*foundFile), 0);
-        return result;
+        int length = path->length;
+        if (length >= 4 && memcmp(path->allocated + length - 4, ".meg", 4) == 0) {
+            return importScript(vm, path, fileName);
+        }
     }
 
-    memcpy(pathEndPtr, ".dll\0", 5);
-    foundFile = findFile(vm, buffer, false);
+    const NativeModuleFunction* builtin = findBuiltinModule(importPath->allocated);
+    if (builtin != NULL) return importBuiltin(vm, builtin, fileName);
 
-    if (foundFile != NULL) {
-        bool result = importSharedLib(vm, foundFile, fileName);
-        reallocate(vm, foundFile, sizeof(*foundFile), 0);
-        return result;
-    }
+    if (path != NULL) return importSharedLib(vm, path->allocated, fileName);
 
     /* No suitable file found */
     msapi_runtimeError(vm, "Could not locate file");
@@ -606,6 +868,15 @@ static bool checkCustomIndexArray(VM* vm, ObjArray* array, Value index) {
     return true;
 }
 
+static bool checkTableKey(VM* vm, Value key) {
+    if (!isValidTableKey(key)) {
+        msapi_runtimeError(vm, "Attempt to index table with a %s key", CHECK_NIL(key) ? "nil" : "NaN");
+        return false;
+    }
+
+    return true;
+}
+
 static ObjUpvalue* captureUpvalue(VM* vm, Value* value, uint8_t stackIndex) {
     ObjUpvalue* previousUpvalue = NULL;
     ObjUpvalue* upvalue = vm->UpvalueHead;
@@ -648,6 +919,7 @@ static ObjUpvalue* closeUpvalues(VM* vm, Value* slot) {
         ObjUpvalue* openUpvalue = vm->UpvalueHead;
         openUpvalue->closed = *openUpvalue->value;
         openUpvalue->value = &openUpvalue->closed;
+        gcWriteBarrier(vm, &openUpvalue->obj, openUpvalue->closed);
         vm->UpvalueHead = openUpvalue->next;
         last = openUpvalue;
     }
@@ -696,6 +968,7 @@ bool msmethod_array_insert(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     
     for (int i = argCount - 1; i >= 0; i--) {
         writeValueArray(&array->array, peek(vm, i));
+        gcWriteBarrier(vm, &array->obj, peek(vm, i));
     }
 
     popn(vm, argCount + 1);
@@ -704,6 +977,456 @@ bool msmethod_array_insert(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     return true;
 }
 
+static bool checkArrayPosition(VM* vm, Value value, int limit, const char* name, int* out) {
+    /* Validates a position argument, 'limit' is the largest value it may take */
+    if (!CHECK_NUMBER(value)) {
+        msapi_runtimeError(vm, "Expected '%s' to be a number", name);
+        return false;
+    }
+
+    double position = AS_NUMBER(value);
+
+    if (floor(position) != position || position < 0) {
+        msapi_runtimeError(vm, "Expected '%s' to be a positive integer, got %g", name, position);
+        return false;
+    }
+
+    if (position > limit) {
+        msapi_runtimeError(vm, "Argument '%s' out of range", name);
+        return false;
+    }
+
+    *out = (int)position;
+    return true;
+}
+
+bool msmethod_array_pop(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+    ObjArray* array = (ObjArray*)self;
+
+    if (array->array.count == 0) {
+        msapi_runtimeError(vm, "Attempt to pop from an empty array");
+        return false;
+    }
+
+    Value value = array->array.values[--array->array.count];
+    popn(vm, argCount + 1);
+
+    if (shouldReturn) push(vm, value);
+    return true;
+}
+
+bool msmethod_array_remove(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+    if (argCount < 1) {
+        msapi_runtimeError(vm, "Expected an index for remove");
+        return false;
+    }
+
+    ObjArray* array = (ObjArray*)self;
+    int index;
+
+    if (array->array.count == 0) {
+        msapi_runtimeError(vm, "Attempt to remove from an empty array");
+        return false;
+    }
+
+    if (!checkArrayPosition(vm, msapi_getArg(vm, 1, argCount), 
+                array->array.count - 1, "index", &index)) return false;
+
+    /* Shift everything after the removed element back by one */
+    Value value = array->array.values[index];
+    memmove(&array->array.values[index], &array->array.values[index + 1], 
+            sizeof(Value) * (array->array.count - index - 1));
+    array->array.count--;
+
+    popn(vm, argCount + 1);
+    if (shouldReturn) push(vm, value);
+    return true;
+}
+
+bool msmethod_array_indexOf(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+    if (argCount < 1) {
+        msapi_runtimeError(vm, "Expected a value to search for");
+        return false;
+    }
+
+    ObjArray* array = (ObjArray*)self;
+    Value value = msapi_getArg(vm, 1, argCount);
+    int index = -1;
+
+    for (int i = 0; i < array->array.count; i++) {
+        if (msapi_isEqual(array->array.values[i], value)) {
+            index = i;
+            break;
+        }
+    }
+
+    popn(vm, argCount + 1);
+    if (shouldReturn) push(vm, NATIVE_TO_NUMBER((double)index));
+    return true;
+}
+
+bool msmethod_array_slice(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+    /* Returns a new array with the elements from 'start' up to but not including 'end', 
+     * both are optional and default to the start and the end of the array */
+    ObjArray* array = (ObjArray*)self;
+    int start = 0;
+    int end = array->array.count;
+
+    if (argCount >= 1 && !checkArrayPosition(vm, msapi_getArg(vm, 1, argCount), 
+                array->array.count, "start", &start)) return false;
+    if (argCount >= 2 && !checkArrayPosition(vm, msapi_getArg(vm, 2, argCount), 
+                array->array.count, "end", &end)) return false;
+
+    if (start > end) {
+        msapi_runtimeError(vm, "Argument 'start' cannot be greater than 'end'");
+        return false;
+    }
+
+    if (!shouldReturn) {
+        popn(vm, argCount + 1);
+        return true;
+    }
+
+    /* The source array stays on the stack while the new one is allocated */
+    ObjArray* slice = allocateArray(vm);
+    int count = end - start;
+
+    if (count > 0) {
+        slice->array.values = GROW_ARRAY(MEMORY_ARRAYS, Value, NULL, 0, count);
+        slice->array.capacity = count;
+        slice->array.count = count;
+        memcpy(slice->array.values, &array->array.values[start], sizeof(Value) * count);
+    }
+
+    popn(vm, argCount + 1);
+    push(vm, OBJ(slice));
+    return true;
+}
+
+bool msmethod_array_reserve(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+    /* Grows the capacity of the array ahead of time so that a known number 
+     * of inserts can be done without any reallocation */
+    if (argCount < 1) {
+        msapi_runtimeError(vm, "Expected a capacity for reserve");
+        return false;
+    }
+
+    ObjArray* array = (ObjArray*)self;
+    int capacity;
+
+    if (!checkArrayPosition(vm, msapi_getArg(vm, 1, argCount), INT32_MAX / (int)sizeof(Value), 
+                "capacity", &capacity)) return false;
+
+    if (capacity > array->array.capacity) {
+        array->array.values = GROW_ARRAY(MEMORY_ARRAYS, Value, array->array.values, array->array.capacity, capacity);
+        array->array.capacity = capacity;
+    }
+
+    popn(vm, argCount + 1);
+    if (shouldReturn) push(vm, NIL());
+    return true;
+}
+
+/* Sorting
+ *
+ * Arrays are sorted in place with an introsort, a quicksort using a median of three 
+ * pivot which switches to heapsort once the recursion gets too deep and leaves 
+ * small ranges to insertion sort. Elements are only ever moved by swapping them inside 
+ * the array, and are always reached through the array object, since a comparator 
+ * can allocate (and trigger a collection) or even modify the array itself */
+
+#define SORT_INSERTION_THRESHOLD 16
+
+typedef struct {
+    ObjArray* array;
+    Value comparator;               /* nil when the default ordering is used */
+    int count;
+} SortState;
+
+static bool sortLess(VM* vm, SortState* state, int a, int b, bool* less) {
+    Value* values = state->array->array.values;
+    Value x = values[a];
+    Value y = values[b];
+
+    if (CHECK_NIL(state->comparator)) {
+        if (CHECK_NUMBER(x) && CHECK_NUMBER(y)) {
+            *less = AS_NUMBER(x) < AS_NUMBER(y);
+            return true;
+        }
+
+        if (CHECK_STRING(x) && CHECK_STRING(y)) {
+            ObjString* s1 = AS_STRING(x);
+            ObjString* s2 = AS_STRING(y);
+            int length = s1->length < s2->length ? s1->length : s2->length;
+            int result = memcmp(s1->allocated, s2->allocated, length);
+
+            *less = result < 0 || (result == 0 && s1->length < s2->length);
+            return true;
+        }
+
+        msapi_runtimeError(vm, "Can only sort numbers or strings without a comparator");
+        return false;
+    }
+
+    push(vm, state->comparator);
+    push(vm, x);
+    push(vm, y);
+    if (!msapi_call(vm, 2)) return false;
+    *less = !isFalsey(pop(vm));
+
+    if (state->array->array.count != state->count) {
+        msapi_runtimeError(vm, "Array was modified while being sorted");
+        return false;
+    }
+
+    return true;
+}
+
+static void sortSwap(SortState* state, int a, int b) {
+    Value* values = state->array->array.values;
+    Value holder = values[a];
+    values[a] = values[b];
+    values[b] = holder;
+}
+
+static bool insertionSort(VM* vm, SortState* state, int lo, int hi) {
+    for (int i = lo + 1; i <= hi; i++) {
+        for (int j = i; j > lo; j--) {
+            bool less;
+            if (!sortLess(vm, state, j, j - 1, &less)) return false;
+            if (!less) break;
+            sortSwap(state, j, j - 1);
+        }
+    }
+
+    return true;
+}
+
+static bool siftDown(VM* vm, SortState* state, int lo, int root, int size) {
+    for (;;) {
+        int child = 2 * root + 1;
+        if (child >= size) return true;
+
+        bool less;
+        if (child + 1 < size) {
+            if (!sortLess(vm, state, lo + child, lo + child + 1, &less)) return false;
+            if (less) child++;
+        }
+
+        if (!sortLess(vm, state, lo + root, lo + child, &less)) return false;
+        if (!less) return true;
+
+        sortSwap(state, lo + root, lo + child);
+        root = child;
+    }
+}
+
+static bool heapSort(VM* vm, SortState* state, int lo, int hi) {
+    int size = hi - lo + 1;
+
+    for (int i = size / 2 - 1; i >= 0; i--) {
+        if (!siftDown(vm, state, lo, i, size)) return false;
+    }
+
+    for (int end = size - 1; end > 0; end--) {
+        sortSwap(state, lo, lo + end);
+        if (!siftDown(vm, state, lo, 0, end)) return false;
+    }
+
+    return true;
+}
+
+static bool partition(VM* vm, SortState* state, int lo, int hi, int* pivot) {
+    int mid = lo + (hi - lo) / 2;
+    bool less;
+
+    /* Order lo, mid and hi, then move the median to the front as the pivot */
+    if (!sortLess(vm, state, mid, lo, &less)) return false;
+    if (less) sortSwap(state, mid, lo);
+    if (!sortLess(vm, state, hi, lo, &less)) return false;
+    if (less) sortSwap(state, hi, lo);
+    if (!sortLess(vm, state, hi, mid, &less)) return false;
+    if (less) sortSwap(state, hi, mid);
+    sortSwap(state, lo, mid);
+
+    int i = lo;
+    int j = hi + 1;
+
+    for (;;) {
+        do {
+            i++;
+            if (i > hi) break;
+            if (!sortLess(vm, state, i, lo, &less)) return false;
+        } while (less);
+
+        do {
+            j--;
+            if (j == lo) break;
+            if (!sortLess(vm, state, lo, j, &less)) return false;
+        } while (less);
+
+        if (i >= j) break;
+        sortSwap(state, i, j);
+    }
+
+    sortSwap(state, lo, j);
+    *pivot = j;
+    return true;
+}
+
+static bool introSort(VM* vm, SortState* state, int lo, int hi, int depth) {
+    while (hi - lo > SORT_INSERTION_THRESHOLD) {
+        if (depth == 0) return heapSort(vm, state, lo, hi);
+        depth--;
+
+        int pivot;
+        if (!partition(vm, state, lo, hi, &pivot)) return false;
+
+        /* Recurse into the smaller half and loop on the larger one, 
+         * which keeps the C stack depth logarithmic */
+        if (pivot - lo < hi - pivot) {
+            if (!introSort(vm, state, lo, pivot - 1, depth)) return false;
+            lo = pivot + 1;
+        } else {
+            if (!introSort(vm, state, pivot + 1, hi, depth)) return false;
+            hi = pivot - 1;
+        }
+    }
+
+    return insertionSort(vm, state, lo, hi);
+}
+
+bool msmethod_array_sort(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+    /* Sorts the array in place, an optional comparator 'cmp(a, b)' 
+     * should return true when 'a' is to be placed before 'b' */
+    SortState state;
+    state.array = (ObjArray*)self;
+    state.comparator = argCount >= 1 ? msapi_getArg(vm, 1, argCount) : NIL();
+    state.count = state.array->array.count;
+
+    if (!CHECK_NIL(state.comparator) && !CHECK_OBJ(state.comparator)) {
+        msapi_runtimeError(vm, "Expected comparator to be a function");
+        return false;
+    }
+
+    int depth = 0;
+    for (int n = state.count; n > 1; n >>= 1) depth += 2;
+
+    /* The comparator and the array are kept on the stack until we finish */
+    if (state.count > 1 && !introSort(vm, &state, 0, state.count - 1, depth)) return false;
+
+    popn(vm, argCount + 1);
+    if (shouldReturn) push(vm, OBJ(self));
+    return true;
+}
+
+#undef SORT_INSERTION_THRESHOLD
+
+static bool checkCallback(VM* vm, int argCount, const char* method) {
+    if (argCount < 1) {
+        msapi_runtimeError(vm, "Expected a function for %s", method);
+        return false;
+    }
+
+    if (!CHECK_OBJ(msapi_getArg(vm, 1, argCount))) {
+        msapi_runtimeError(vm, "Expected argument to be a function");
+        return false;
+    }
+
+    return true;
+}
+
+bool msmethod_array_map(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+    /* Calls 'f(value, index)' on every element and collects the results in a new array */
+    if (!checkCallback(vm, argCount, "map")) return false;
+
+    ObjArray* array = (ObjArray*)self;
+    Value function = msapi_getArg(vm, 1, argCount);
+    ObjArray* result = allocateArray(vm);
+    /* Push the result to protect it from the garbage collector */
+    push(vm, OBJ(result));
+
+    for (int i = 0; i < array->array.count; i++) {
+        push(vm, function);
+        push(vm, array->array.values[i]);
+        push(vm, NATIVE_TO_NUMBER((double)i));
+        if (!msapi_call(vm, 2)) return false;
+
+        writeValueArray(&result->array, peek(vm, 0));
+        gcWriteBarrier(vm, &result->obj, peek(vm, 0));
+        pop(vm);
+    }
+
+    popn(vm, argCount + 2);
+    if (shouldReturn) push(vm, OBJ(result));
+    return true;
+}
+
+bool msmethod_array_filter(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+    /* Returns a new array with the elements for which 'f(value, index)' is truthy */
+    if (!checkCallback(vm, argCount, "filter")) return false;
+
+    ObjArray* array = (ObjArray*)self;
+    Value function = msapi_getArg(vm, 1, argCount);
+    ObjArray* result = allocateArray(vm);
+    push(vm, OBJ(result));
+
+    for (int i = 0; i < array->array.count; i++) {
+        Value value = array->array.values[i];
+
+        push(vm, function);
+        push(vm, value);
+        push(vm, NATIVE_TO_NUMBER((double)i));
+        if (!msapi_call(vm, 2)) return false;
+
+        /* The value is safe from the collector through the return value until here */
+        if (!isFalsey(peek(vm, 0))) {
+            writeValueArray(&result->array, value);
+            gcWriteBarrier(vm, &result->obj, value);
+        }
+        pop(vm);
+    }
+
+    popn(vm, argCount + 2);
+    if (shouldReturn) push(vm, OBJ(result));
+    return true;
+}
+
+bool msmethod_array_reduce(VM* vm, Obj* self, int argCount, bool shouldReturn) {
+    /* Folds the array from the left with 'f(accumulator, value)', starting 
+     * from the initial value if given, otherwise from the first element */
+    if (!checkCallback(vm, argCount, "reduce")) return false;
+
+    ObjArray* array = (ObjArray*)self;
+    Value function = msapi_getArg(vm, 1, argCount);
+    int start = 0;
+
+    if (argCount >= 2) {
+        push(vm, msapi_getArg(vm, 2, argCount));
+    } else if (array->array.count > 0) {
+        push(vm, array->array.values[0]);
+        start = 1;
+    } else {
+        msapi_runtimeError(vm, "Attempt to reduce an empty array without an initial value");
+        return false;
+    }
+
+    /* The accumulator always sits on top of the stack between calls */
+    for (int i = start; i < array->array.count; i++) {
+        Value accumulator = pop(vm);
+
+        push(vm, function);
+        push(vm, accumulator);
+        push(vm, array->array.values[i]);
+        if (!msapi_call(vm, 2)) return false;
+    }
+
+    Value result = pop(vm);
+    popn(vm, argCount + 1);
+    if (shouldReturn) push(vm, result);
+    return true;
+}
+
 bool msmethod_string_getAscii(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     ObjString* string = (ObjString*)self;
     popn(vm, argCount + 1);
@@ -749,13 +1472,17 @@ bool msmethod_string_split(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     int delLen = strlen(delimeter);
     char* right = NULL;
 
+    /* The array stays on the stack while the pieces are allocated, 
+     * so the collector can reach it */
     ObjArray* array = allocateArray(vm);
+    push(vm, OBJ(array));
     
     while (token != NULL) {
         int length = (int)(token - mainString);
         ObjString* string = allocateString(vm, mainString, length);
         right = token + delLen;
         writeValueArray(&array->array, OBJ(string));
+        gcWriteBarrier(vm, &array->obj, OBJ(string));
 
         token = strstr(right, delimeter);
         mainString = right;
@@ -764,8 +1491,10 @@ bool msmethod_string_split(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     if (right != NULL) {
         ObjString* rightString = allocateString(vm, right, strlen(right));
         writeValueArray(&array->array, OBJ(rightString));
+        gcWriteBarrier(vm, &array->obj, OBJ(rightString));
     }
 
+    pop(vm);
     msapi_popn(vm, argCount + 1);
 
     if (shouldReturn) {
@@ -830,11 +1559,17 @@ bool msmethod_table_keys(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     ObjArray* array = allocateArray(vm);
     ObjTable* table = (ObjTable*)self;
 
-    for (int i = 0; i < table->table.capacity; i++) {
+    for (int i = 0; i < table->table.array.count; i++) {
+        if (!CHECK_NIL(table->table.array.values[i])) {
+            writeValueArray(&array->array, NATIVE_TO_NUMBER((double)i));
+        }
+    }
+
+    for (int i = 0; i < table->table.entryCount; i++) {
         Entry* entry = &table->table.entries[i];
 
-        if (entry->key != NULL) {
-            writeValueArray(&array->array, OBJ(entry->key));
+        if (!CHECK_NIL(entry->key)) {
+            writeValueArray(&array->array, entry->key);
         }
     }
 
@@ -853,7 +1588,7 @@ bool msmethod_dll_close(VM* vm, Obj* self, int argCount, bool shouldReturn) {
         return true;
     }
 
-    dlclose(container->handle);
+    if (container->handle != NULL) dlclose(container->handle);
     container->handle = NULL;
     container->closed = true;
     
@@ -882,6 +1617,14 @@ bool msmethod_dll_query(VM* vm, Obj* self, int argCount, bool shouldReturn) {
     }
 
     popn(vm, argCount + 1);
+
+    if (container->natives != NULL) {
+        Value native = NIL();
+        getTable(&container->natives->table, AS_STRING(query), &native);
+        push(vm, native);
+        return true;
+    }
+
     NativeMethodPtr ptr = dlsym(container->handle, AS_NATIVE_STRING(query));
     
     push(vm, ptr == NULL ? NIL() : OBJ(allocateNativeMethod(vm, AS_STRING(query), &container->obj, ptr)));
@@ -889,7 +1632,7 @@ bool msmethod_dll_query(VM* vm, Obj* self, int argCount, bool shouldReturn) {
 }
 /* ---------------------------------------------- */
 
-static InterpretResult run(VM* vm) {
+static InterpretResult run(VM* vm, int exitFrame) {
     CallFrame* frame = &vm->frames[vm->frameCount - 1];
 
     for (;;) {
@@ -1030,6 +1773,7 @@ static InterpretResult run(VM* vm) {
             }
             case OP_RETFILE: {
                 ObjString* moduleName = vm->currentModule->moduleName;
+                ObjString* modulePath = vm->currentModule->modulePath;
 
                 /* Move all upvalues to the heap */
                 closeUpvalues(vm, frame->slotPtr);
@@ -1063,8 +1807,8 @@ static InterpretResult run(VM* vm) {
                 /* Restore globals */
                 vm->globals = frame->closure->env;
 
-                insertTable(&vm->importCache, moduleName, OBJ(userTable));
-                insertTable(&vm->globals->table, moduleName, OBJ(userTable));
+                insertTable(&vm->importCache, modulePath, OBJ(userTable));
+                setGlobal(vm, moduleName, OBJ(userTable));
                 break;
             }
             case OP_CLASS: {
@@ -1088,6 +1832,7 @@ static InterpretResult run(VM* vm) {
                  * local variable, and so we might need to look for the class 1 or 0 place higher */
                 ObjClass* klass = AS_CLASS(peek(vm, inherits + 1));
                 insertTable(&klass->fields, fieldName, val);
+                gcWriteBarrierEntry(vm, &klass->obj, OBJ(fieldName), val);
                 pop(vm);
                 break;
             }
@@ -1099,6 +1844,7 @@ static InterpretResult run(VM* vm) {
                 ObjClass* klass = AS_CLASS(peek(vm, inherits + 1));
                 
                 insertTable(&klass->fields, fieldName, val);
+                gcWriteBarrierEntry(vm, &klass->obj, OBJ(fieldName), val);
                 pop(vm);
                 break;
 
@@ -1117,12 +1863,14 @@ static InterpretResult run(VM* vm) {
                     case OBJ_INSTANCE: {
                         ObjInstance* instance = AS_INSTANCE(setVal);
                         insertTable(&instance->table, fieldName, val);
+                        gcWriteBarrierEntry(vm, &instance->obj, OBJ(fieldName), val);
                         popn(vm, 3);
                         break;
                     }
                     case OBJ_TABLE: {
                         ObjTable* table = AS_TABLE(setVal);
-                        insertTable(&table->table, fieldName, val);
+                        insertValueTable(&table->table, OBJ(fieldName), val);
+                        gcWriteBarrierEntry(vm, &table->obj, OBJ(fieldName), val);
                         popn(vm, 3);
                         break;
                     }
@@ -1232,6 +1980,31 @@ static InterpretResult run(VM* vm) {
                         break;
                     
                     }
+                    case OBJ_DLL_CONTAINER: {
+                        ObjDllContainer* container = AS_DLL_CONTAINER(getVal);
+                        Value value;
+
+                        if (container->natives != NULL && getTable(&container->natives->table, fieldName, &value)) {
+                            popn(vm, 2);
+                            push(vm, value);
+                            break;
+                        }
+
+                        NativeMethodPtr ptr = NULL;
+                        bool found = getPtrTable(&vm->dllMethods, fieldName, (void*)&ptr);
+
+                        if (found) {
+                            ObjNativeMethod* method = allocateNativeMethod(vm, fieldName,
+                                            (Obj*)AS_OBJ(getVal), ptr);
+                            popn(vm, 2);
+                            push(vm, OBJ(method));
+                            break;
+                        }
+
+                        popn(vm, 2);
+                        push(vm, NIL());
+                        break;
+                    }
                     default: 
                         msapi_runtimeError(vm, "Attempt to index a non-indexable object");
                         return INTERPRET_RUNTIME_ERROR;
@@ -1244,6 +2017,7 @@ static InterpretResult run(VM* vm) {
                 ObjClass* klass = AS_CLASS(peek(vm, inherits + 1));
                 
                 insertTable(&klass->methods, closure->function->name, OBJ(closure));
+                gcWriteBarrierEntry(vm, &klass->obj, OBJ(closure->function->name), OBJ(closure));
                 pop(vm);
                 break;
             }
@@ -1255,6 +2029,8 @@ static InterpretResult run(VM* vm) {
             case OP_CLOSURE: {
                 ObjFunction* function = AS_FUNCTION(READ_CONSTANT(frame));
                 ObjClosure* closure = allocateClosure(vm, function, vm->globals);
+                /* Capturing can allocate, so the closure is pushed first */ 
+                push(vm, OBJ(closure));
 
                 for (int i = 0; i < closure->upvalueCount; i++) {
                     bool isLocal = READ_BYTE(frame);
@@ -1265,14 +2041,15 @@ static InterpretResult run(VM* vm) {
                     } else {
                         closure->upvalues[i] = frame->closure->upvalues[index];
                     }
+                    gcWriteBarrier(vm, &closure->obj, OBJ(closure->upvalues[i]));
                 }
-
-                push(vm, OBJ(closure));
                 break;
             }
             case OP_CLOSURE_LONG: {
                 ObjFunction* function = AS_FUNCTION(READ_LONG_CONSTANT(frame));
                 ObjClosure* closure = allocateClosure(vm, function, vm->globals);
+                /* Capturing can allocate, so the closure is pushed first */ 
+                push(vm, OBJ(closure));
 
                 for (int i = 0; i < closure->upvalueCount; i++) {
                     bool isLocal = READ_BYTE(frame);
@@ -1283,9 +2060,8 @@ static InterpretResult run(VM* vm) {
                     } else {
                         closure->upvalues[i] = frame->closure->upvalues[index];
                     }
+                    gcWriteBarrier(vm, &closure->obj, OBJ(closure->upvalues[i]));
                 }
-
-                push(vm, OBJ(closure));
                 break;
             }
             case OP_GET_UPVALUE: {
@@ -1295,7 +2071,9 @@ static InterpretResult run(VM* vm) {
             }
             case OP_ASSIGN_UPVALUE: {
                 uint8_t index = READ_BYTE(frame);
-                *frame->closure->upvalues[index]->value = pop(vm);
+                ObjUpvalue* upvalue = frame->closure->upvalues[index];
+                *upvalue->value = pop(vm);
+                gcWriteBarrier(vm, &upvalue->obj, *upvalue->value);
                 break;
             }
             case OP_PLUS_ASSIGN_UPVALUE: {
@@ -1310,9 +2088,9 @@ static InterpretResult run(VM* vm) {
                     );
                 } else if (CHECK_STRING(oldValue) && CHECK_STRING(increment)) {
                     /* String increment */ 
-                    *frame->closure->upvalues[index]->value = OBJ(
-                        strConcat(vm, oldValue, increment)
-                    );
+                    ObjUpvalue* upvalue = frame->closure->upvalues[index];
+                    *upvalue->value = OBJ(strConcat(vm, oldValue, increment));
+                    gcWriteBarrier(vm, &upvalue->obj, *upvalue->value);
                 } else {
                     msapi_runtimeError(vm, "Error : Can only use '+=' on string on number pairs");
                     return INTERPRET_RUNTIME_ERROR;
@@ -1509,7 +2287,8 @@ static InterpretResult run(VM* vm) {
                 Value value = pop(vm);
                 ObjTable* table = AS_TABLE(peek(vm, 0));
 
-                insertTable(&table->table, key, value);
+                insertValueTable(&table->table, OBJ(key), value);
+                gcWriteBarrierEntry(vm, &table->obj, OBJ(key), value);
                 break;
             }
             case OP_TABLE_INS_LONG: {
@@ -1517,13 +2296,15 @@ static InterpretResult run(VM* vm) {
                 Value value = pop(vm);
                 ObjTable* table = AS_TABLE(peek(vm, 0));
 
-                insertTable(&table->table, key, value);
+                insertValueTable(&table->table, OBJ(key), value);
+                gcWriteBarrierEntry(vm, &table->obj, OBJ(key), value);
                 break;
             }
             case OP_ARRAY_INS: {
                 Value value = pop(vm);
                 Value array = peek(vm, 0);
                 writeValueArray(&AS_ARRAY(array)->array, value);
+                gcWriteBarrier(vm, AS_OBJ(array), value);
                 break;
             }
             case OP_CUSTOM_INDEX_MOD: {
@@ -1542,17 +2323,16 @@ static InterpretResult run(VM* vm) {
 
                         if (!checkCustomIndexArray(vm, array, index)) return INTERPRET_RUNTIME_ERROR;
                         array->array.values[(int)AS_NUMBER(index)] = value;
+                        gcWriteBarrier(vm, &array->obj, value);
                         break;
                     }
                     case OBJ_TABLE: {
                         ObjTable* table = AS_TABLE(valArray);
                         
-                        if (!CHECK_STRING(index)) {
-                            msapi_runtimeError(vm, "Expected table index to be a string");
-                            return INTERPRET_RUNTIME_ERROR;
-                        }
+                        if (!checkTableKey(vm, index)) return INTERPRET_RUNTIME_ERROR;
 
-                        insertTable(&table->table, AS_STRING(index), value);
+                        insertValueTable(&table->table, index, value);
+                        gcWriteBarrierEntry(vm, &table->obj, index, value);
                         break;
                     }
                     default:
@@ -1584,6 +2364,7 @@ static InterpretResult run(VM* vm) {
                             *oldValuePtr = NATIVE_TO_NUMBER(AS_NUMBER(oldValue) + AS_NUMBER(value));   
                         } else if (CHECK_STRING(oldValue) && CHECK_STRING(value)) {
                             *oldValuePtr = OBJ(strConcat(vm, oldValue, value));
+                            gcWriteBarrier(vm, &array->obj, *oldValuePtr);
                         } else {
                             msapi_runtimeError(vm, "Attempt to use '+=' on a non number/string value");
                             return INTERPRET_RUNTIME_ERROR;
@@ -1593,23 +2374,20 @@ static InterpretResult run(VM* vm) {
                     case OBJ_TABLE: {
                         ObjTable* table = AS_TABLE(valArray);
 
-                        if (!CHECK_STRING(index)) {
-                            msapi_runtimeError(vm, "Expected table index to be a string");
-                            return INTERPRET_RUNTIME_ERROR;
-                        }
+                        if (!checkTableKey(vm, index)) return INTERPRET_RUNTIME_ERROR;
 
                         Value oldValue = NIL();
-                        getTable(&table->table, AS_STRING(index), &oldValue);
+                        getValueTable(&table->table, index, &oldValue);
 
                         if (CHECK_NUMBER(oldValue) && CHECK_NUMBER(value)) { 
-                            insertTable(&table->table, 
-                                        AS_STRING(index), 
+                            insertValueTable(&table->table, 
+                                        index, 
                                             NATIVE_TO_NUMBER(
-                                                AS_NUMBER(oldValue) - AS_NUMBER(value)));
+                                                AS_NUMBER(oldValue) + AS_NUMBER(value)));
                         } else if (CHECK_STRING(oldValue) && CHECK_STRING(value)) {
-                            insertTable(&table->table, 
-                                        AS_STRING(index),
-                                            OBJ(strConcat(vm, oldValue, value)));
+                            Value result = OBJ(strConcat(vm, oldValue, value));
+                            insertValueTable(&table->table, index, result);
+                            gcWriteBarrier(vm, &table->obj, result);
                         } else {
                             msapi_runtimeError(vm, "Attempt to call '+=' on a non-numeric/string value");
                             return INTERPRET_RUNTIME_ERROR;
@@ -1653,21 +2431,18 @@ static InterpretResult run(VM* vm) {
                     case OBJ_TABLE: {
                         ObjTable* table = AS_TABLE(valArray);
 
-                        if (!CHECK_STRING(index)) {
-                            msapi_runtimeError(vm, "Expected table index to be a string");
-                            return INTERPRET_RUNTIME_ERROR;
-                        }
+                        if (!checkTableKey(vm, index)) return INTERPRET_RUNTIME_ERROR;
 
                         Value oldValue = NIL();
-                        getTable(&table->table, AS_STRING(index), &oldValue);
+                        getValueTable(&table->table, index, &oldValue);
                         
                         if (!CHECK_NUMBER(oldValue) || !CHECK_NUMBER(value)) {
                             msapi_runtimeError(vm, "Attempt to call '-=' on a non numeric value");
                             return INTERPRET_RUNTIME_ERROR;
                         }
 
-                        insertTable(&table->table, 
-                                        AS_STRING(index), 
+                        insertValueTable(&table->table, 
+                                        index, 
                                             NATIVE_TO_NUMBER(
                                                 AS_NUMBER(oldValue) - AS_NUMBER(value)));
                         break;
@@ -1710,21 +2485,18 @@ static InterpretResult run(VM* vm) {
                     case OBJ_TABLE: {
                         ObjTable* table = AS_TABLE(valArray);
 
-                        if (!CHECK_STRING(index)) {
-                            msapi_runtimeError(vm, "Expected table index to be a string");
-                            return INTERPRET_RUNTIME_ERROR;
-                        }
+                        if (!checkTableKey(vm, index)) return INTERPRET_RUNTIME_ERROR;
 
                         Value oldValue = NIL();
-                        getTable(&table->table, AS_STRING(index), &oldValue);
+                        getValueTable(&table->table, index, &oldValue);
                         
                         if (!CHECK_NUMBER(oldValue) || !CHECK_NUMBER(value)) {
                             msapi_runtimeError(vm, "Attempt to call '*=' on a non numeric value");
                             return INTERPRET_RUNTIME_ERROR;
                         }
 
-                        insertTable(&table->table, 
-                                        AS_STRING(index), 
+                        insertValueTable(&table->table, 
+                                        index, 
                                             NATIVE_TO_NUMBER(
                                                 AS_NUMBER(oldValue) * AS_NUMBER(value)));
                         break;
@@ -1764,21 +2536,18 @@ static InterpretResult run(VM* vm) {
                     case OBJ_TABLE: {
                         ObjTable* table = AS_TABLE(valArray);
 
-                        if (!CHECK_STRING(index)) {
-                            msapi_runtimeError(vm, "Expected table index to be a string");
-                            return INTERPRET_RUNTIME_ERROR;
-                        }
+                        if (!checkTableKey(vm, index)) return INTERPRET_RUNTIME_ERROR;
 
                         Value oldValue = NIL();
-                        getTable(&table->table, AS_STRING(index), &oldValue);
+                        getValueTable(&table->table, index, &oldValue);
                         
                         if (!CHECK_NUMBER(oldValue) || !CHECK_NUMBER(value)) {
                             msapi_runtimeError(vm, "Attempt to call '/=' on a non numeric value");
                             return INTERPRET_RUNTIME_ERROR;
                         }
 
-                        insertTable(&table->table, 
-                                        AS_STRING(index), 
+                        insertValueTable(&table->table, 
+                                        index, 
                                             NATIVE_TO_NUMBER(
                                                 AS_NUMBER(oldValue) / AS_NUMBER(value)));
                         break;
@@ -1818,21 +2587,18 @@ static InterpretResult run(VM* vm) {
                     case OBJ_TABLE: {
                         ObjTable* table = AS_TABLE(valArray);
 
-                        if (!CHECK_STRING(index)) {
-                            msapi_runtimeError(vm, "Expected table index to be a string");
-                            return INTERPRET_RUNTIME_ERROR;
-                        }
+                        if (!checkTableKey(vm, index)) return INTERPRET_RUNTIME_ERROR;
 
                         Value oldValue = NIL();
-                        getTable(&table->table, AS_STRING(index), &oldValue);
+                        getValueTable(&table->table, index, &oldValue);
                         
                         if (!CHECK_NUMBER(oldValue) || !CHECK_NUMBER(value)) {
                             msapi_runtimeError(vm, "Attempt to call '^=' on a non numeric value");
                             return INTERPRET_RUNTIME_ERROR;
                         }
 
-                        insertTable(&table->table, 
-                                        AS_STRING(index), 
+                        insertValueTable(&table->table, 
+                                        index, 
                                             NATIVE_TO_NUMBER(
                                                 pow(AS_NUMBER(oldValue), AS_NUMBER(value))));
                         break;
@@ -1889,13 +2655,10 @@ static InterpretResult run(VM* vm) {
                     case OBJ_TABLE: {
                         ObjTable* table = AS_TABLE(valArray);
 
-                        if (!CHECK_STRING(index)) {
-                            msapi_runtimeError(vm, "Attempt to index table with non-string index");
-                            return INTERPRET_RUNTIME_ERROR;
-                        }
+                        if (!checkTableKey(vm, index)) return INTERPRET_RUNTIME_ERROR;
                         
                         Value tableVal = NIL();
-                        bool found = getTable(&table->table, AS_STRING(index), &tableVal);
+                        bool found = getValueTable(&table->table, index, &tableVal);
                         
                         if (found) {
                             push(vm, tableVal);
@@ -2052,6 +2815,21 @@ static InterpretResult run(VM* vm) {
                         break;
                     }
                     case OBJ_DLL_CONTAINER: {
+                        /* Registered natives are called directly */ 
+                        ObjDllContainer* container = AS_DLL_CONTAINER(callVal);
+                        Value native;
+
+                        if (container->natives != NULL && getTable(&container->natives->table, string, &native)) {
+                            if (container->closed) {
+                                msapi_runtimeError(vm, "Attempt to call into a closed dll");
+                                return INTERPRET_RUNTIME_ERROR;
+                            }
+
+                            vm->stackTop[-argCount - 1] = native;
+                            if (!callValue(vm, native, shouldReturn, argCount)) return INTERPRET_RUNTIME_ERROR;
+                            break;
+                        }
+
                         bool result = invokeNativeMethod(vm, string,
                                 callVal.as.obj, argCount, shouldReturn, &vm->dllMethods);
                         
@@ -2121,6 +2899,7 @@ static InterpretResult run(VM* vm) {
                 }
                 
                 copyTableAll(&AS_CLASS(superclass)->methods, &klass->methods);
+                gcWriteBarrierAll(vm, &klass->obj);
                 break;
             }
             case OP_GET_SUPER: { 
@@ -2187,6 +2966,9 @@ static InterpretResult run(VM* vm) {
                     push(vm, ret); 
                 }
 
+                /* A nested call made through msapi_call has finished, hand 
+                 * control back to the native that made it */
+                if (vm->frameCount == exitFrame) return INTERPRET_OK;
                 break;
             }
             case OP_RETEOF: {
@@ -2196,7 +2978,7 @@ static InterpretResult run(VM* vm) {
             }
             case OP_DEFINE_GLOBAL: {
                 Value name = READ_CONSTANT(frame);
-                insertTable(&vm->globals->table, AS_STRING(name), pop(vm));
+                setGlobal(vm, AS_STRING(name), pop(vm));
 
                 if (vm->currentModule != NULL) {
                     writeObjStringArray(&vm->currentModule->customGlobals, AS_STRING(name));
@@ -2205,7 +2987,7 @@ static InterpretResult run(VM* vm) {
             }
             case OP_DEFINE_LONG_GLOBAL: {
                 Value name = READ_LONG_CONSTANT(frame);
-                insertTable(&vm->globals->table, AS_STRING(name), pop(vm));
+                setGlobal(vm, AS_STRING(name), pop(vm));
 
                 if (vm->currentModule != NULL) {
                     writeObjStringArray(&vm->currentModule->customGlobals, AS_STRING(name));
@@ -2233,14 +3015,14 @@ static InterpretResult run(VM* vm) {
                 Value name;
                 Value feeder;
                 ASSIGN_GLOBAL(vm, frame, name, feeder);
-                insertTable(&vm->globals->table, AS_STRING(name), pop(vm));
+                setGlobal(vm, AS_STRING(name), pop(vm));
                 break;
             }
             case OP_ASSIGN_LONG_GLOBAL: {
                 Value name;
                 Value feeder;
                 ASSIGN_LONG_GLOBAL(vm, frame, name, feeder);
-                insertTable(&vm->globals->table, AS_STRING(name), pop(vm));
+                setGlobal(vm, AS_STRING(name), pop(vm));
                 break;
             }
             case OP_PLUS_ASSIGN_GLOBAL: {
@@ -2250,12 +3032,12 @@ static InterpretResult run(VM* vm) {
                 ASSIGN_GLOBAL(vm, frame, name, feeder);
             
                 if (CHECK_NUMBER(feeder) && CHECK_NUMBER(increment)) {
-                    insertTable(&vm->globals->table, AS_STRING(name), NATIVE_TO_NUMBER(
+                    setGlobal(vm, AS_STRING(name), NATIVE_TO_NUMBER(
                             AS_NUMBER(feeder) + AS_NUMBER(increment)
                     ));
 
                 } else if (CHECK_STRING(feeder) && CHECK_STRING(increment)) {
-                    insertTable(&vm->globals->table, AS_STRING(name), OBJ(
+                    setGlobal(vm, AS_STRING(name), OBJ(
                                 strConcat(vm, feeder, increment)
                     ));
                 } else {
@@ -2274,12 +3056,12 @@ static InterpretResult run(VM* vm) {
                 ASSIGN_LONG_GLOBAL(vm, frame, name, feeder);
                 
                 if (CHECK_NUMBER(feeder) && CHECK_NUMBER(increment)) {
-                    insertTable(&vm->globals->table, AS_STRING(name), NATIVE_TO_NUMBER(
+                    setGlobal(vm, AS_STRING(name), NATIVE_TO_NUMBER(
                             AS_NUMBER(feeder) + AS_NUMBER(increment)
                     ));
 
                 } else if (CHECK_STRING(feeder) && CHECK_STRING(increment)) {
-                    insertTable(&vm->globals->table, AS_STRING(name), OBJ(
+                    setGlobal(vm, AS_STRING(name), OBJ(
                                 strConcat(vm, feeder, increment)
                     ));
                 } else {
@@ -2308,7 +3090,7 @@ static InterpretResult run(VM* vm) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 
-                insertTable(&vm->globals->table, AS_STRING(name), NATIVE_TO_NUMBER(
+                setGlobal(vm, AS_STRING(name), NATIVE_TO_NUMBER(
                             AS_NUMBER(feeder) - AS_NUMBER(increment)
                 ));
                 break;
@@ -2330,7 +3112,7 @@ static InterpretResult run(VM* vm) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 
-                insertTable(&vm->globals->table, AS_STRING(name), NATIVE_TO_NUMBER(
+                setGlobal(vm, AS_STRING(name), NATIVE_TO_NUMBER(
                             AS_NUMBER(feeder) - AS_NUMBER(increment)
                 ));
                 break;
@@ -2353,7 +3135,7 @@ static InterpretResult run(VM* vm) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 
-                insertTable(&vm->globals->table, AS_STRING(name), NATIVE_TO_NUMBER(
+                setGlobal(vm, AS_STRING(name), NATIVE_TO_NUMBER(
                             AS_NUMBER(feeder) * AS_NUMBER(increment)
                 ));
                 break;
@@ -2375,7 +3157,7 @@ static InterpretResult run(VM* vm) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 
-                insertTable(&vm->globals->table, AS_STRING(name), NATIVE_TO_NUMBER(
+                setGlobal(vm, AS_STRING(name), NATIVE_TO_NUMBER(
                             AS_NUMBER(feeder) * AS_NUMBER(increment)
                 ));
                 break;
@@ -2404,7 +3186,7 @@ static InterpretResult run(VM* vm) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
-                insertTable(&vm->globals->table, AS_STRING(name), NATIVE_TO_NUMBER(
+                setGlobal(vm, AS_STRING(name), NATIVE_TO_NUMBER(
                             AS_NUMBER(feeder) / AS_NUMBER(increment)
                 ));
                 break;
@@ -2432,7 +3214,7 @@ static InterpretResult run(VM* vm) {
                 }
 
 
-                insertTable(&vm->globals->table, AS_STRING(name), NATIVE_TO_NUMBER(
+                setGlobal(vm, AS_STRING(name), NATIVE_TO_NUMBER(
                             AS_NUMBER(feeder) / AS_NUMBER(increment)
                 ));
                 break;
@@ -2455,7 +3237,7 @@ static InterpretResult run(VM* vm) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 
-                insertTable(&vm->globals->table, AS_STRING(name), NATIVE_TO_NUMBER(
+                setGlobal(vm, AS_STRING(name), NATIVE_TO_NUMBER(
                             pow(AS_NUMBER(feeder), AS_NUMBER(increment))
                 ));
                 break;
@@ -2477,7 +3259,7 @@ static InterpretResult run(VM* vm) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 
-                insertTable(&vm->globals->table, AS_STRING(name), NATIVE_TO_NUMBER(
+                setGlobal(vm, AS_STRING(name), NATIVE_TO_NUMBER(
                             pow(AS_NUMBER(feeder), AS_NUMBER(increment))
                 ));
                 break;
@@ -2794,7 +3576,7 @@ InterpretResult interpret(VM* vm, ObjFunction* function) {
     vm->frames[vm->frameCount] = newFrame;
     vm->frameCount++;
 
-    InterpretResult result = run(vm); 
+    InterpretResult result = run(vm, 0); 
     // it gets popped by RETEOF
 
     vm->running = false;